@@ -4,10 +4,42 @@
 #include "../../config.h"
 
 #define BACKLIGHT_BREATHING
+//#define DEBOUNCE_EAGER_PRESS      // チャタリング除去  押した時はすぐに反映し、離した時だけ待つ（1スキャンのノイズも入力になる）
 #define TAPPING_TERM 135
+#define LOWER_TAPPING_TERM TAPPING_TERM  // Lowerキー（英数/無変換）のタップとみなす時間
+#define RAISE_TAPPING_TERM TAPPING_TERM  // Raiseキー（かな/変換）のタップとみなす時間
+#define COMBO_TERM 50               // 同時押し（Lower+Raise、レイヤーロック）とみなす時間(ms)
+#define ADAPTIVE_TAPPING_TERM       // 上記とSFT_JQTのタップとみなす時間を打鍵から学習する
+#define ADAPTIVE_TERM_MIN 80        // 学習するタップとみなす時間の下限(ms)
+#define ADAPTIVE_TERM_MAX 200       // 学習するタップとみなす時間の上限(ms)
+#define ADAPTIVE_TERM_SAVE_STEP 8   // 学習した平均がこれ以上変わったら設定を保存(ms)
 
 #define SWAP_LCTR_LGUI
 
+//#define SPARSE_KEYMAP             // ほとんど空のレイヤーを詰めて保存し、フラッシュを節約する
+//#define KEYCODE_CACHE             // レイヤー変更時に各キーの有効なキーコードを求めておき、キーごとのレイヤーの検索を1回の読み出しにする（RAM 96バイト）
+
+#define SETTINGS_EEPROM_ADDR 0x100  // 設定を保存するEEPROMのアドレス
+#define SETTINGS_SLOTS 16           // 設定の書き込み位置の数（EEPROMの書き換え回数を分散）
+#define SETTINGS_COMMIT_DELAY 5000  // 設定の変更が止まってからEEPROMに書き込むまでの時間(ms)
+
+#define MOUSEKEY_INERTIA            // マウスキーを慣性のある動きにする
+#define MK_INERTIA_INTERVAL 8       // 移動の間隔(ms)
+#define MK_INERTIA_ACCEL 32         // 1回ごとの加速(1/256ピクセル)
+#define MK_INERTIA_MAX 2048         // 1回の最大移動量(1/256ピクセル)
+#define MK_INERTIA_WHEEL_ACCEL 8    // ホイールの加速(1/256目盛り)
+#define MK_INERTIA_WHEEL_MAX 48     // ホイールの1回の最大移動量(1/256目盛り)
+
+#define IDLE_QUIET_TIME 60000      // キー操作がなくなってからLEDとサウンドを止めるまでの時間(ms)
+#define IDLE_SLOW_SCAN_TIME 300000 // キー操作がなくなってからスキャンの間隔を空けるまでの時間(ms)
+#define IDLE_SCAN_INTERVAL 5       // 間隔を空けた時のスキャンの間隔(ms)  間はCPUを止める（AVRのみ）
+
+#define MACRO_CHAR_INTERVAL 10      // マクロの1文字ごとの送信間隔(ms)
+#define MACRO_CANCEL_ON_KEYPRESS    // マクロ送信中にキーを押すと中止
+//#define MACRO_ROLLING_REPORTS     // マクロの前の文字を離すのと次の文字を押すのを1つのレポートで送る
+
+#define KEYTRACE_SIZE 256           // キー入力の記録のバッファ(byte)  rules.mkのKEYTRACE_ENABLEで有効
+
 #ifdef AUDIO_ENABLE
 
     #define LAYER_LOCK_ON_SOUND \
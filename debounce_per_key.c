@@ -0,0 +1,76 @@
+// キーごとのチャタリング除去
+// config.hでDEBOUNCE_EAGER_PRESSを定義すると、押した時はすぐに反映し、離した時だけDEBOUNCE(ms)の間安定するのを待つ
+// 定義しなければ押した時も離した時もDEBOUNCE(ms)の間安定するのを待つ
+// 状態は行ごとのビット列で持ち、待ち時間はキーごとのカウンターで数える
+
+#include "matrix.h"
+#include "timer.h"
+#include "quantum.h"
+#include "debounce.h"
+
+#ifndef DEBOUNCE
+  #define DEBOUNCE 5
+#endif
+
+static matrix_row_t counting[MATRIX_ROWS];              // 待ち時間を数えているキー
+static uint8_t counters[MATRIX_ROWS][MATRIX_COLS];      // 残りの待ち時間(ms)
+static uint16_t last_time;
+
+void debounce_init(uint8_t num_rows) {
+    for (uint8_t row = 0; row < num_rows; row++) {
+        counting[row] = 0;
+    }
+    last_time = timer_read();
+}
+
+void debounce(matrix_row_t raw[], matrix_row_t cooked[], uint8_t num_rows, bool changed) {
+    if (!changed && !debounce_active()) return;         // 変化がなく、数えているキーもない（rawとcookedは同じ）
+
+    uint16_t now = timer_read();
+    uint16_t elapsed = TIMER_DIFF_16(now, last_time);
+    last_time = now;
+    if (elapsed > UINT8_MAX) elapsed = UINT8_MAX;
+
+    for (uint8_t row = 0; row < num_rows; row++) {
+        matrix_row_t diff = raw[row] ^ cooked[row];
+        matrix_row_t active = diff | counting[row];
+        if (!active) continue;                          // ほとんどの行はここで終わり
+
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            matrix_row_t bit = (matrix_row_t)1 << col;
+            if (!(active & bit)) continue;
+
+            if (!(diff & bit)) {                        // 元の状態に戻った（チャタリング）
+                counting[row] &= ~bit;
+                continue;
+            }
+            #ifdef DEBOUNCE_EAGER_PRESS
+            if (raw[row] & bit) {                       // 押した時はすぐに反映
+                cooked[row] |= bit;
+                counting[row] &= ~bit;
+                continue;
+            }
+            #endif
+            if (!(counting[row] & bit)) {               // 変化し始めたところから数える
+                counting[row] |= bit;
+                counters[row][col] = DEBOUNCE;
+            } else if (counters[row][col] > elapsed) {
+                counters[row][col] -= elapsed;
+                continue;
+            } else {
+                counters[row][col] = 0;
+            }
+            if (counters[row][col] == 0) {              // 待ち時間の間変化しなかったので反映
+                cooked[row] ^= bit;
+                counting[row] &= ~bit;
+            }
+        }
+    }
+}
+
+bool debounce_active(void) {
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (counting[row]) return true;
+    }
+    return false;
+}
@@ -3,12 +3,25 @@
 // macOSの設定でキーボードをJIS配列として認識させ、コントロールキーとコマンドキーを入れ替えておく
 // Windowsの設定で「無変換」キーをIMEオフ（日本語入力オフ）に、「変換」キーをIMEオン（日本語入力オン）に設定しておく
 // iOS機などUS配列でしか認識できない機器で使う場合はデフォルトレイヤーをUSに切り替える
+// AdjustレイヤーでIMEキーを送るOSを固定すると、そのOS用のキーだけを送る（自動ではWindowsと判別できた場合のみ）
 
 #include "planck.h"
 #include "action_layer.h"
 // "keymap_jp.h"はJISで認識されたキーボードをUS配列として使うためのキーコード
 // ただしシフトキーを押したときの挙動は別に処理を書く必要あり
 #include "keymap_jp.h"  // qmk_firmware/quantum/keymap_extras/keymap_jp.h
+#include <stddef.h>
+#include "eeprom.h"
+#ifdef PROTOCOL_LUFA
+  #include "lufa.h"       // USB_DeviceState
+#endif
+#ifdef __AVR__
+  #include <avr/sleep.h>
+#endif
+#if defined(LATENCY_TRACE_ENABLE) || defined(KEYTRACE_ENABLE)
+  #include <string.h>
+  #include "raw_hid.h"
+#endif
 
 extern keymap_config_t keymap_config;
 
@@ -17,8 +30,7 @@ enum planck_layers {
   _JIS,             // デフォルトレイヤー（JIS配列で認識） MacとWindowsでの共用を想定
   _US,              // デフォルトレイヤー（ US配列で認識） JISで認識させられないiOS機器を想定
   _LOWER,           // Lower
-  _RAISE,           // Raise
-  _RAISE_US,        // Raise (US配列用)
+  _RAISE,           // Raise            JIS/US共用（JIS配列ではシフト変換テーブルで変換）
   _FUNC1,           // Function_1      移動、レイヤートグルなど
   _FUNC2,           // Function_2      マクロ用
   _ADJUST           // Adjust          設定変更など
@@ -29,23 +41,50 @@ enum planck_keycodes {
   JIS = SAFE_RANGE, // デフォルトレイヤーをJIS配列用に切替
   US,               // デフォルトレイヤーをUS配列用に切替
   SFT_JQT,          // タップでJISの「'」  ホールドで右Shift
-  WN_SCLN,          // タップでJISの「;」  シフトでJISの「:」
+  M_EMHL,           // タップでMacの「英数」かWindowsの「無変換」  ホールドでLowerレイヤー
+  M_KHKR,           // タップでMacの「かな」かWindowsの「変換」    ホールドでRaiseレイヤー
   TGL_RIS,          // トグルでRaiseレイヤーに切り替え
   TGL_LOW,          // トグルでLowerレイヤーに切り替え
+  OS_AUTO,          // IMEキーの送信先OSを自動判別
+  OS_MAC,           // IMEキーの送信先OSをMacに固定
+  OS_WIN,           // IMEキーの送信先OSをWindowsに固定
+  REC_TGL,          // キー入力の記録を開始/停止
   MACRO_1,          // 以下、マクロ
   MACRO_2,
   MACRO_3,
+  PLANCK_KEYCODES_END
+};
+
+// IMEキーを送る接続先のOS
+enum host_os {
+  HOST_AUTO,        // 自動（判別できなければMacとWindows両方のキーを送る）
+  HOST_MAC,
+  HOST_WIN
+};
+
+// タップ/ホールドを判定するキー
+enum tap_hold_keys {
+  TH_LOWER,         // M_EMHL
+  TH_RAISE,         // M_KHKR
+  TH_SFT_JQT,       // SFT_JQT
+  TH_COUNT
 };
 
-// 特殊な動作のマクロ設定
-enum user_macro {
-  UM_EMHL,
-  UM_KHKR,
-  UM_KHRU
+// キーコードごとの処理  process_key_handlerがキーコードから選ぶ
+enum key_handlers {
+  KH_NONE,          // 何もしない（QMKに任せる）
+  KH_DEFAULT_LAYER, // JIS, US
+  KH_LOCK_LAYER,    // TGL_LOW, TGL_RIS
+  KH_LOWER_RAISE,   // M_EMHL, M_KHKR
+  KH_SFT_JQT,       // SFT_JQT
+  KH_HOST_OS,       // OS_AUTO, OS_MAC, OS_WIN
+  KH_MACRO,         // MACRO_1〜
+  KH_KEYTRACE,      // REC_TGL
+  KH_CAPS_SONG,     // WN_CAPS       （以下、音を鳴らすだけ）
+  KH_BL_SONG,       // BL_*
+  KH_ADJUST_SONG,   // ADJUST
+  KH_COUNT
 };
-#define M_EMHL MACROTAP(UM_EMHL)      // タップでMacの「英数」とWindowsの「無変換」  ホールドでLowerレイヤー
-#define M_KHKR MACROTAP(UM_KHKR)      // タップでMacの「かな」とWindowsの「変換」    ホールドでRaiseレイヤー
-#define M_KHRU MACROTAP(UM_KHRU)      // タップでMacの「かな」とWindowsの「変換」    ホールドでRaise(US配列)レイヤー
 
 // ユーザー定義のキーコード
 #define FN1_ESC LT(_FUNC1,KC_ESC)     // タップでESC                 ホールドでFunction_1レイヤーon
@@ -70,6 +109,14 @@ enum user_macro {
   #define GUI_F1  LGUI(KC_F1)         // ウインドウ切り替えショートカット           (Mac)
 #endif
 
+// ほとんどが空のレイヤーはキーの位置ごとに K(行, 列, キーコード)、T(行, 列) = _______、T_ROW(行) = 行すべて_______ で書く
+// 書かなかった位置はXXXXXXX
+// SPARSE_KEYMAPを定義すると、これらのレイヤーはキーのある位置のビットマップと詰めたキーコードだけを持つ
+#define DENSE_KEY(r, c, kc)  [r][c] = kc,
+#define DENSE_TRNS(r, c)     [r][c] = KC_TRNS,
+#define DENSE_TRNS_ROW(r)    [r] = { KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS, \
+                                     KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS, KC_TRNS },
+
 // キーマップ
 const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
 
@@ -86,7 +133,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
  */
 [_JIS] = {
   {FN2_TAB, KC_Q,    KC_W,    KC_E,    KC_R,    KC_T,    KC_Y,    KC_U,    KC_I,    KC_O,    KC_P,    KC_BSPC},
-  {FN1_ESC, KC_A,    KC_S,    KC_D,    KC_F,    KC_G,    KC_H,    KC_J,    KC_K,    KC_L,    WN_SCLN, KC_ENT },
+  {FN1_ESC, KC_A,    KC_S,    KC_D,    KC_F,    KC_G,    KC_H,    KC_J,    KC_K,    KC_L,    KC_SCLN, KC_ENT },
   {KC_LSFT, KC_Z,    KC_X,    KC_C,    KC_V,    KC_B,    KC_N,    KC_M,    KC_COMM, KC_DOT,  KC_SLSH, SFT_JQT},
   {CTL_ZH,  ADJUST,  KC_LALT, MY_GUI,  M_EMHL,  KC_SPC,  KC_SPC,  M_KHKR,  KC_LEFT, KC_DOWN, KC_UP,   KC_RGHT}
 },
@@ -96,7 +143,7 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
   {FN2_TAB, KC_Q,    KC_W,    KC_E,    KC_R,    KC_T,    KC_Y,    KC_U,    KC_I,    KC_O,    KC_P,    KC_BSPC},
   {FN1_ESC, KC_A,    KC_S,    KC_D,    KC_F,    KC_G,    KC_H,    KC_J,    KC_K,    KC_L,    KC_SCLN, KC_ENT },
   {KC_LSFT, KC_Z,    KC_X,    KC_C,    KC_V,    KC_B,    KC_N,    KC_M,    KC_COMM, KC_DOT,  KC_SLSH, RSFT_QT},
-  {CTL_ZH,  ADJUST,  KC_LALT, KC_LGUI, M_EMHL,  KC_SPC,  KC_SPC,  M_KHRU,  KC_LEFT, KC_DOWN, KC_UP,   KC_RGHT}
+  {CTL_ZH,  ADJUST,  KC_LALT, KC_LGUI, M_EMHL,  KC_SPC,  KC_SPC,  M_KHKR,  KC_LEFT, KC_DOWN, KC_UP,   KC_RGHT}
 },
 
 /* Lower
@@ -129,16 +176,8 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
  * `-----------------------------------------------------------------------------------'
  */
 [_RAISE] = {
-  {_______, KC_EXLM, JP_AT,   KC_HASH, KC_DLR,  KC_PERC, JP_CIRC, JP_AMPR, JP_ASTR, JP_LPRN, JP_RPRN, KC_BSPC},
-  {_______, XXXXXXX, MY_VOLD, MY_VOLU, KC_MUTE, JP_YEN,  JP_GRV,  KC_MINS, JP_EQL,  JP_LBRC, JP_RBRC, _______},
-  {WN_CAPS, XXXXXXX, KC_MRWD, KC_MFFD, KC_MPLY, JP_PIPE, JP_TILD, JP_UNDS, JP_PLUS, JP_LCBR, JP_RCBR, WN_CAPS},
-  {_______, _______, _______, _______, XXXXXXX, _______, _______, _______, _______, _______, _______, _______}
-},
-
-/* Raise (US配列) */
-[_RAISE_US] = {
   {_______, KC_EXLM, KC_AT,   KC_HASH, KC_DLR,  KC_PERC, KC_CIRC, KC_AMPR, KC_ASTR, KC_LPRN, KC_RPRN, KC_BSPC},
-  {_______, XXXXXXX, MY_VOLD, MY_VOLU, KC_MUTE, KC_BSLS, KC_GRV,  KC_MINS, KC_EQL,  KC_LBRC ,KC_RBRC, _______},
+  {_______, XXXXXXX, MY_VOLD, MY_VOLU, KC_MUTE, KC_BSLS, KC_GRV,  KC_MINS, KC_EQL,  KC_LBRC, KC_RBRC, _______},
   {WN_CAPS, XXXXXXX, KC_MRWD, KC_MFFD, KC_MPLY, KC_PIPE, KC_TILD, KC_UNDS, KC_PLUS, KC_LCBR, KC_RCBR, WN_CAPS},
   {_______, _______, _______, _______, XXXXXXX, _______, _______, _______, _______, _______, _______, _______}
 },
@@ -172,39 +211,675 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
  * |      |      |      |      |      |             |      |      |      |      |      |
  * `-----------------------------------------------------------------------------------'
  */
-[_FUNC2] = {
-  {_______, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, MACRO_1, MACRO_2, MACRO_3, XXXXXXX, XXXXXXX, _______},
-  {XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, _______},
-  {XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX},
-  {_______, _______, _______, _______, _______, _______, _______, _______, _______, _______, _______, _______}
-},
+#define FUNC2_LAYER(K, T, T_ROW) \
+  T(0, 0)                                              K(0, 6, MACRO_1) K(0, 7, MACRO_2) K(0, 8, MACRO_3)                     T(0, 11) \
+                                                                                                                              T(1, 11) \
+  T_ROW(3)
+#ifndef SPARSE_KEYMAP
+[_FUNC2] = { FUNC2_LAYER(DENSE_KEY, DENSE_TRNS, DENSE_TRNS_ROW) },
+#endif
 
 /* Adjust      設定変更など
  * ,-----------------------------------------------------------------------------------.
- * |TaskMN|Reset |      |      |      |      |      |      |      |      |      |      |
+ * |TaskMN|Reset |      |      |      |      |      |OSauto|  Mac |  Win |      |      |
  * |------+------+------+------+------+-------------+------+------+------+------+------|
- * |Power |      |      |Aud on|Audoff|      |      | JIS  |  US  |      |      |      |
+ * |Power |      |      |Aud on|Audoff|      |      | JIS  |  US  | Rec  |      |      |
  * |------+------+------+------+------+------|------+------+------+------+------+------|
  * |      |Voice-|Voice+|Mus on|Musoff|      |      |BLtogg| BL - | BL + |BLstep|      |
  * |------+------+------+------+------+------+------+------+------+------+------+------|
  * |      |      |      |      |      |             |      |      |      |      |      |
  * `-----------------------------------------------------------------------------------'
  */
-[_ADJUST] = {
-  {TASK,    RESET,   XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, XXXXXXX, _______},
-  {KC_POWER,XXXXXXX, MU_MOD,  AU_ON,   AU_OFF,  XXXXXXX, XXXXXXX, JIS,     US,      XXXXXXX, XXXXXXX, _______},
-  {XXXXXXX, MUV_DE,  MUV_IN,  MU_ON,   MU_OFF,  XXXXXXX, XXXXXXX, BL_TOGG, BL_DEC,  BL_INC,  BL_STEP, XXXXXXX},
-  {_______, _______, _______, _______, _______, _______, _______, _______, _______, _______, _______, _______}
-},
+#define ADJUST_LAYER(K, T, T_ROW) \
+  K(0, 0, TASK)     K(0, 1, RESET)                                                 K(0, 7, OS_AUTO) K(0, 8, OS_MAC)  K(0, 9, OS_WIN)  T(0, 11) \
+  K(1, 0, KC_POWER)                  K(1, 2, MU_MOD) K(1, 3, AU_ON)  K(1, 4, AU_OFF)  K(1, 7, JIS)     K(1, 8, US)      K(1, 9, REC_TGL) T(1, 11) \
+                    K(2, 1, MUV_DE)  K(2, 2, MUV_IN) K(2, 3, MU_ON)  K(2, 4, MU_OFF)  K(2, 7, BL_TOGG) K(2, 8, BL_DEC)  K(2, 9, BL_INC)  K(2, 10, BL_STEP) \
+  T_ROW(3)
+#ifndef SPARSE_KEYMAP
+[_ADJUST] = { ADJUST_LAYER(DENSE_KEY, DENSE_TRNS, DENSE_TRNS_ROW) },
+#endif
+
+};
+
+#ifdef SPARSE_KEYMAP
+// 疎なレイヤー  行ごとに、keysのビットが立っている位置はcodesから、transの位置は_______、それ以外はXXXXXXX
+// codesの並びはキーの位置の順（行優先）  位置はbase（前の行までのキーの数）+ 同じ行のそれより前のキーの数
+// レイヤー全体のビットマップとcodesの並びはコンパイル時に計算するので、Kを書く順番は自由
+// 実行時は16ビットの行のビットマップだけを使う（64ビットの演算のライブラリを持ち込まない）
+#define SPARSE_BIT(r, c)          ((uint64_t)1 << ((r) * MATRIX_COLS + (c)))
+#define SPARSE_KEY_BIT(r, c, kc)  | SPARSE_BIT(r, c)
+#define SPARSE_TRNS_BIT(r, c)     | SPARSE_BIT(r, c)
+#define SPARSE_TRNS_ROW(r)        | ((((uint64_t)1 << MATRIX_COLS) - 1) << ((r) * MATRIX_COLS))
+#define SPARSE_SKIP_KEY(r, c, kc)
+#define SPARSE_SKIP_TRNS(r, c)
+#define SPARSE_SKIP_ROW(r)
+#define SPARSE_ROW(mask, r)       (((mask) >> ((r) * MATRIX_COLS)) & ((1 << MATRIX_COLS) - 1))
+#define SPARSE_KEY_COUNT(r, c, kc) + 1
+
+// 行ごとのビットマップを列挙定数にしておく（Kの展開の中でレイヤーのマクロをもう一度展開できないため）
+#define SPARSE_ROWS_ENUM(name, mask) enum { \
+    name##_ROW0 = SPARSE_ROW(mask, 0), name##_ROW1 = SPARSE_ROW(mask, 1), \
+    name##_ROW2 = SPARSE_ROW(mask, 2), name##_ROW3 = SPARSE_ROW(mask, 3) }
+#define SPARSE_ROW_MASK(name, r)  ((r) == 0 ? name##_ROW0 : (r) == 1 ? name##_ROW1 : (r) == 2 ? name##_ROW2 : name##_ROW3)
+#define SPARSE_BASE(name, r)      (((r) > 0 ? __builtin_popcount(name##_ROW0) : 0) + \
+                                   ((r) > 1 ? __builtin_popcount(name##_ROW1) : 0) + \
+                                   ((r) > 2 ? __builtin_popcount(name##_ROW2) : 0))
+#define SPARSE_RANK(name, r, c)   (SPARSE_BASE(name, r) + __builtin_popcount(SPARSE_ROW_MASK(name, r) & ((1 << (c)) - 1)))
+#define SPARSE_ROWS(name)         { name##_ROW0, name##_ROW1, name##_ROW2, name##_ROW3 }
+#define SPARSE_BASES(name)        { SPARSE_BASE(name, 0), SPARSE_BASE(name, 1), SPARSE_BASE(name, 2), SPARSE_BASE(name, 3) }
+
+_Static_assert(MATRIX_ROWS == 4 && MATRIX_COLS <= 16, "SPARSE_KEYMAP assumes a 4 x 12 Planck matrix");
+
+typedef struct {
+    matrix_row_t    keys[MATRIX_ROWS];
+    matrix_row_t    trans[MATRIX_ROWS];
+    uint8_t         base[MATRIX_ROWS];
+} sparse_layer_t;
+
+#define SPARSE_LAYER_FIRST _FUNC2    // これ以降のレイヤーが疎なレイヤー
+SPARSE_ROWS_ENUM(FUNC2_KEYS,   0 FUNC2_LAYER(SPARSE_KEY_BIT, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW));
+SPARSE_ROWS_ENUM(FUNC2_TRANS,  0 FUNC2_LAYER(SPARSE_SKIP_KEY, SPARSE_TRNS_BIT, SPARSE_TRNS_ROW));
+SPARSE_ROWS_ENUM(ADJUST_KEYS,  0 ADJUST_LAYER(SPARSE_KEY_BIT, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW));
+SPARSE_ROWS_ENUM(ADJUST_TRANS, 0 ADJUST_LAYER(SPARSE_SKIP_KEY, SPARSE_TRNS_BIT, SPARSE_TRNS_ROW));
+#define FUNC2_CODE(r, c, kc)  [SPARSE_RANK(FUNC2_KEYS, r, c)] = kc,
+#define ADJUST_CODE(r, c, kc) [SPARSE_RANK(ADJUST_KEYS, r, c)] = kc,
+
+// 同じ位置を2回書くと、後のKが前のKを黙って上書きしてしまうので止める
+_Static_assert((0 FUNC2_LAYER(SPARSE_KEY_COUNT, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW)) == SPARSE_BASE(FUNC2_KEYS, 3) + __builtin_popcount(FUNC2_KEYS_ROW3),
+               "the same position is written twice in FUNC2_LAYER");
+_Static_assert((0 ADJUST_LAYER(SPARSE_KEY_COUNT, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW)) == SPARSE_BASE(ADJUST_KEYS, 3) + __builtin_popcount(ADJUST_KEYS_ROW3),
+               "the same position is written twice in ADJUST_LAYER");
 
+const uint16_t PROGMEM func2_codes[]  = { FUNC2_LAYER(FUNC2_CODE, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW) };
+const uint16_t PROGMEM adjust_codes[] = { ADJUST_LAYER(ADJUST_CODE, SPARSE_SKIP_TRNS, SPARSE_SKIP_ROW) };
+
+const sparse_layer_t PROGMEM sparse_layers[] = {
+    [_FUNC2 - SPARSE_LAYER_FIRST] = {
+        .keys  = SPARSE_ROWS(FUNC2_KEYS),
+        .trans = SPARSE_ROWS(FUNC2_TRANS),
+        .base  = SPARSE_BASES(FUNC2_KEYS)
+    },
+    [_ADJUST - SPARSE_LAYER_FIRST] = {
+        .keys  = SPARSE_ROWS(ADJUST_KEYS),
+        .trans = SPARSE_ROWS(ADJUST_TRANS),
+        .base  = SPARSE_BASES(ADJUST_KEYS)
+    },
+};
+// codesの配列の場所はRAMに置く（PROGMEMのポインタをpgm_read_wordで読むと、ARMのrev6などポインタが16ビットでない環境で壊れる）
+static const uint16_t * const sparse_codes[] = {
+    [_FUNC2 - SPARSE_LAYER_FIRST]  = func2_codes,
+    [_ADJUST - SPARSE_LAYER_FIRST] = adjust_codes,
 };
 
+static uint16_t keymap_layer_keycode(uint8_t layer, keypos_t key) {
+    if (layer < SPARSE_LAYER_FIRST) {
+        return pgm_read_word(&keymaps[layer][key.row][key.col]);
+    }
+    const sparse_layer_t *sparse = &sparse_layers[layer - SPARSE_LAYER_FIRST];
+    matrix_row_t keys = pgm_read_word(&sparse->keys[key.row]);
+    matrix_row_t bit = (matrix_row_t)1 << key.col;
+    if (keys & bit) {
+        uint8_t index = pgm_read_byte(&sparse->base[key.row]);
+        for (keys &= bit - 1; keys; keys &= keys - 1) {   // 同じ行のこの位置より前のキーを数える
+            index++;
+        }
+        return pgm_read_word(&sparse_codes[layer - SPARSE_LAYER_FIRST][index]);
+    }
+    return (pgm_read_word(&sparse->trans[key.row]) & bit) ? KC_TRNS : KC_NO;
+}
+#elif defined(KEYCODE_CACHE)
+static uint16_t keymap_layer_keycode(uint8_t layer, keypos_t key) {
+    return pgm_read_word(&keymaps[layer][key.row][key.col]);
+}
+#endif
+
+#ifdef KEYCODE_CACHE
+// 有効なキーコードのキャッシュ  レイヤーが変わった時に、一番上のレイヤーから見た各キーのキーコード（透過を解決したもの）を求めておく
+// QMKはキーごとに上のレイヤーから透過でないキーを探すが、一番上のレイヤーで必ず見つかるので1回の読み出しで終わる
+static uint16_t keycode_cache[MATRIX_ROWS][MATRIX_COLS];
+static uint32_t keycode_cache_layers;          // キャッシュを作った時のレイヤー（layer_state | default_layer_state）
+static uint8_t  keycode_cache_top = 0xFF;      // その一番上のレイヤー  0xFFはまだ作っていない
+
+// layerから下のonになっているレイヤーをたどって透過を解決する
+static uint16_t keycode_resolve(uint8_t layer, uint32_t layers, keypos_t key) {
+    uint16_t keycode = keymap_layer_keycode(layer, key);
+    while (keycode == KC_TRNS && layer-- > 0) {
+        if (layers & (1UL << layer)) {
+            keycode = keymap_layer_keycode(layer, key);
+        }
+    }
+    return keycode;
+}
+
+void keycode_cache_build(uint32_t layers) {
+    keycode_cache_layers = layers;
+    keycode_cache_top = biton32(layers);
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            keypos_t key = { .col = col, .row = row };
+            keycode_cache[row][col] = keycode_resolve(keycode_cache_top, layers, key);
+        }
+    }
+}
+#endif
+
+#if defined(SPARSE_KEYMAP) || defined(KEYCODE_CACHE)
+uint16_t keymap_key_to_keycode(uint8_t layer, keypos_t key) {
+    #ifdef KEYCODE_CACHE
+      if (layer == keycode_cache_top) {
+          return keycode_cache[key.row][key.col];
+      }
+      // 押した時のレイヤーで離す場合（押している間にレイヤーが変わった）は、そのレイヤーから下で解決する
+      return keycode_resolve(layer, keycode_cache_layers, key);
+    #else
+      return keymap_layer_keycode(layer, key);
+    #endif
+}
+#endif
+
+// 保存する設定
+typedef union {
+  uint32_t raw;
+  struct {
+    uint8_t host_os :2;              // IMEキーを送るOS（enum host_os）
+    uint8_t tap_avg[TH_COUNT];       // 学習したタップの平均押下時間(ms)  0は未学習
+  };
+} user_config_t;
+user_config_t user_config;
+
+// 設定の保存  設定はRAM上で変更し、変更が止まってしばらくしてから（またはサスペンド前に）EEPROMに書き込む
+// EEPROMの書き込み位置は毎回ずらし、チェックサムが合うものの中で一番新しいものを使う
+typedef struct {
+    uint8_t       seq;               // 書き込んだ順番
+    uint8_t       default_layer;
+    user_config_t config;
+    uint8_t       checksum;
+} settings_slot_t;
+
+static uint8_t  settings_default_layer = _JIS;
+static uint8_t  settings_seq;        // 最後に書き込んだスロットのseq
+static uint8_t  settings_slot;       // 最後に書き込んだスロット
+static bool     settings_dirty = false;
+static bool     settings_applied = false;
+static uint16_t settings_timer;
+
+#define SETTINGS_SLOT_ADDR(i) ((settings_slot_t *)(SETTINGS_EEPROM_ADDR + (i) * sizeof(settings_slot_t)))
+
+uint8_t settings_checksum(const settings_slot_t *slot) {
+    const uint8_t *p = (const uint8_t *)slot;
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < offsetof(settings_slot_t, checksum); i++) {
+        sum += p[i];
+    }
+    return ~sum;                     // 消去状態(0xFF)や0で埋まったスロットは一致しない
+}
+
+void settings_load(void) {
+    settings_slot_t slot;
+    bool found = false;
+
+    for (uint8_t i = 0; i < SETTINGS_SLOTS; i++) {
+        eeprom_read_block(&slot, SETTINGS_SLOT_ADDR(i), sizeof(slot));
+        if (slot.checksum != settings_checksum(&slot)) continue;
+        if (found && (int8_t)(slot.seq - settings_seq) <= 0) continue;
+        found = true;
+        settings_seq = slot.seq;
+        settings_slot = i;
+        settings_default_layer = slot.default_layer;
+        user_config = slot.config;
+    }
+    if (!found) {                    // 保存したものがなければ以前のEEPROMの設定から読む
+        user_config.raw = eeconfig_read_user();
+        settings_default_layer = biton32(eeconfig_read_default_layer());
+    }
+    // 書き込んだことのない値（0xFF）などはデフォルトに戻す
+    if (user_config.host_os > HOST_WIN) {
+        user_config.host_os = HOST_AUTO;
+    }
+    #ifdef ADAPTIVE_TAPPING_TERM
+    for (uint8_t i = 0; i < TH_COUNT; i++) {
+        if (user_config.tap_avg[i] > ADAPTIVE_TERM_MAX) {
+            user_config.tap_avg[i] = 0;
+        }
+    }
+    #endif
+}
+
+// 設定を変更した時に呼ぶ（すぐには書き込まない）
+void settings_save(void) {
+    settings_dirty = true;
+    settings_timer = timer_read();
+}
+
+void settings_commit(void) {
+    settings_slot_t slot;
+    if (!settings_dirty) return;
+    settings_dirty = false;
+    settings_seq++;
+    settings_slot = (settings_slot + 1) % SETTINGS_SLOTS;
+    slot.seq = settings_seq;
+    slot.default_layer = settings_default_layer;
+    slot.config = user_config;
+    slot.checksum = settings_checksum(&slot);
+    eeprom_update_block(&slot, SETTINGS_SLOT_ADDR(settings_slot), sizeof(slot));
+}
+
+void settings_task(void) {
+    if (!settings_applied) {         // 起動時のEEPROMのデフォルトレイヤーの読み込みの後で反映する
+        settings_applied = true;
+        default_layer_set(1UL << settings_default_layer);
+    }
+    if (settings_dirty && timer_elapsed(settings_timer) > SETTINGS_COMMIT_DELAY) {
+        settings_commit();
+    }
+}
+
+// デフォルトレイヤーの切り替え  set_single_persistent_default_layerの代わり
+// 切り替えの音（DEFAULT_LAYER_SONGS）はキーの処理（handle_default_layer）から曲の予約で鳴らす
+void set_default_layer_saved(uint8_t layer) {
+    default_layer_set(1UL << layer);
+    settings_default_layer = layer;
+    settings_save();
+}
+
+void suspend_power_down_user(void) {
+    settings_commit();
+}
+
+void tap_hold_init(void);
+
 // 初期設定
 void matrix_init_user(void) {
     #ifdef BACKLIGHT_ENABLE
     backlight_disable();             // LEDを消しておく
     #endif
+    settings_load();
+    #ifdef ADAPTIVE_TAPPING_TERM
+      tap_hold_init();
+    #endif
+}
+
+// 接続先OSの判別  MacはNumLockのLEDをonにしないので、NumLockをonにしてきたホストはWindowsとみなす
+// 当てにならない判別方法なので注意  NumLockをoffのまま使うWindowsはMacとみなされ（両方のキーを送る）、
+// NumLockをonにするLinuxなどはWindowsとみなされる  確実にしたい場合はAdjustレイヤーでOSを固定する
+// KVMやUSBハブで接続先を切り替えた時のため、サスペンドからの復帰とUSBの再接続で判別し直す
+static bool host_win_detected = false;
+
+void led_set_user(uint8_t usb_led) {
+    if (usb_led & (1 << USB_LED_NUM_LOCK)) {
+        host_win_detected = true;
+    }
+}
+
+void suspend_wakeup_init_user(void) {
+    host_win_detected = false;
+}
+
+void host_detect_task(void) {
+    #ifdef PROTOCOL_LUFA
+      if (USB_DeviceState != DEVICE_STATE_Configured) {   // 再接続中  接続し直したホストがLEDの状態を送ってくる
+          host_win_detected = false;
+      }
+    #endif
+}
+
+uint8_t ime_host(void) {
+    if (user_config.host_os == HOST_AUTO && host_win_detected) return HOST_WIN;
+    return user_config.host_os;
+}
+
+// マクロの文字列送信  SEND_STRINGのように送り終わるまで止まらず、メインループで少しずつ送る
+static const char *macro_str = NULL;   // 送信中の文字列（PROGMEM）  NULLなら送信していない
+static uint16_t macro_timer;
+
+void send_string_async(const char *str) {
+    macro_str = str;
+    macro_timer = timer_read() - MACRO_CHAR_INTERVAL;   // 1文字目はすぐに送る
+}
+
+#ifdef MACRO_ROLLING_REPORTS
+// 前の文字のキーを離すのと次の文字のキーを押すのを1つのレポートで送る（1文字ほぼ1レポート）
+// 1つのレポートで新しく押すキーは常に1つなので、ホストが順番を入れ替えることはない
+// 同じキーが続く場合とシフトの有無が変わる場合は、一度離してから押す
+static uint8_t macro_rolling_key = KC_NO;   // 押したままの前の文字のキー
+static bool macro_rolling_shift;
+
+void macro_rolling_release(void) {
+    if (macro_rolling_key == KC_NO) return;
+    del_key(macro_rolling_key);
+    send_keyboard_report();
+    macro_rolling_key = KC_NO;
+}
+
+void send_rolling_char(char ascii_code) {
+    uint8_t keycode = pgm_read_byte(&ascii_to_keycode_lut[(uint8_t)ascii_code]);
+    bool shift = pgm_read_byte(&ascii_to_shift_lut[(uint8_t)ascii_code]);
+    uint8_t saved_mods = get_mods();
+
+    if (keycode == KC_NO) return;          // 送れない文字は飛ばす
+    if (macro_rolling_key != KC_NO && (keycode == macro_rolling_key || shift != macro_rolling_shift)) {
+        macro_rolling_release();
+    }
+    set_mods(shift ? MOD_BIT(KC_LSFT) : 0);
+    if (macro_rolling_key == KC_NO && shift) {
+        send_keyboard_report();            // シフトはキーより先に押しておく
+    }
+    if (macro_rolling_key != KC_NO) del_key(macro_rolling_key);
+    add_key(keycode);
+    send_keyboard_report();
+    set_mods(saved_mods);
+    macro_rolling_key = keycode;
+    macro_rolling_shift = shift;
+}
+#endif
+
+// マクロの送信を終える（途中で止める場合も）
+void macro_stop(void) {
+    #ifdef MACRO_ROLLING_REPORTS
+      macro_rolling_release();
+    #endif
+    macro_str = NULL;
+}
+
+void macro_task(void) {
+    if (macro_str == NULL || timer_elapsed(macro_timer) < MACRO_CHAR_INTERVAL) return;
+    char ascii_code = pgm_read_byte(macro_str);
+    if (ascii_code) {
+        #ifdef MACRO_ROLLING_REPORTS
+          send_rolling_char(ascii_code);
+        #else
+          send_char(ascii_code);
+        #endif
+        macro_str++;
+        macro_timer = timer_read();
+    } else {
+        macro_stop();
+    }
+}
+
+#ifdef LATENCY_TRACE_ENABLE
+// 処理時間の計測  キーごとの処理の記録をリングバッファに残し、Raw HIDで読み出す
+// キーの変化の検出時刻はチャタリング除去後（record->event.time）、レポートの送信はprocess_record_userの直後に行われる
+#define TRACE_SIZE    16             // 記録する件数
+#define TRACE_LAYERS  8
+#define TRACE_BUCKETS 8              // ヒストグラムの区間  4us, 8us, 16us ... 512us以上
+#define TRACE_PACKET  32             // Raw HIDのパケットサイズ
+#define TRACE_KEYCODES 8             // ヒストグラムを取るキーコードの数  あふれた分は最後にまとめる
+
+typedef struct {
+    uint16_t keycode;
+    uint8_t  layer;                  // 最上位のレイヤー
+    uint8_t  pressed;
+    uint16_t event_time;             // キーの変化を検出した時刻(ms)
+    uint16_t entry;                  // process_record_userを開始した時刻(ms)
+    uint16_t cost;                   // process_record_userの処理時間(4us単位)
+} trace_entry_t;
+
+static trace_entry_t trace_buf[TRACE_SIZE];
+static uint8_t trace_head;
+static uint16_t trace_key_hist[TRACE_LAYERS][TRACE_BUCKETS];   // レイヤーごとのprocess_record_userの処理時間
+static uint16_t trace_scan_hist[TRACE_BUCKETS];                // matrix_scan_user（マクロ、サウンドなど）の処理時間
+
+typedef struct {
+    uint16_t keycode;                // 最後のスロットはそれ以外のキーコード全部
+    uint16_t hist[TRACE_BUCKETS];
+} trace_keycode_hist_t;
+static trace_keycode_hist_t trace_keycode_hist[TRACE_KEYCODES + 1];   // キーコードごとの処理時間  押された順に割り当てる
+static uint8_t trace_keycode_count;
+
+typedef struct {
+    uint16_t calls;
+    uint32_t time;                   // 処理時間の合計(4us単位)
+} key_handler_stat_t;
+static key_handler_stat_t key_handler_stats[KH_COUNT];         // キーコードごとの処理の回数と時間
+
+typedef struct {
+    uint16_t wakes;                  // 復帰した回数
+    uint16_t last;                   // 最後の復帰の遅れ(ms)
+    uint16_t max;
+    uint32_t total;
+} trace_wake_stat_t;
+static trace_wake_stat_t trace_wake_stat;   // 省電力のスキャンから復帰した最初のキーの遅れ（idle_key_processedで計測）
+
+// 4us単位の時刻  AVRではタイマー0が1msで250カウントするのでそれも使う
+// 2つを読む間にタイマー0が一周するとずれるので、ミリ秒のカウンターが変わっていたら読み直す
+uint16_t trace_clock(void) {
+    #ifdef __AVR__
+      uint16_t ms;
+      uint8_t ticks;
+      do {
+          ms = timer_read();
+          ticks = TCNT0;
+      } while (ms != timer_read());
+      return ms * 250 + ticks;
+    #else
+      return timer_read() * 250;
+    #endif
+}
+
+void trace_hist_add(uint16_t *hist, uint16_t cost) {
+    uint8_t bucket = 0;
+    while (cost > 1 && bucket < TRACE_BUCKETS - 1) {
+        cost >>= 1;
+        bucket++;
+    }
+    if (hist[bucket] < UINT16_MAX) hist[bucket]++;
+}
+
+void trace_record(uint16_t keycode, keyrecord_t *record, uint16_t entry, uint16_t cost) {
+    trace_entry_t *t = &trace_buf[trace_head];
+    t->keycode    = keycode;
+    t->layer      = biton32(layer_state | default_layer_state);
+    t->pressed    = record->event.pressed;
+    t->event_time = record->event.time;
+    t->entry      = entry;
+    t->cost       = cost;
+    trace_head = (trace_head + 1) % TRACE_SIZE;
+    trace_hist_add(trace_key_hist[t->layer % TRACE_LAYERS], cost);
+
+    uint8_t i;
+    for (i = 0; i < trace_keycode_count && trace_keycode_hist[i].keycode != keycode; i++);
+    if (i == trace_keycode_count && i < TRACE_KEYCODES) {
+        trace_keycode_hist[i].keycode = keycode;
+        trace_keycode_count++;
+    }
+    trace_hist_add(trace_keycode_hist[i].hist, cost);
+}
+
+void trace_wake_record(uint16_t latency) {
+    if (trace_wake_stat.wakes < UINT16_MAX) trace_wake_stat.wakes++;
+    trace_wake_stat.last = latency;
+    if (latency > trace_wake_stat.max) trace_wake_stat.max = latency;
+    trace_wake_stat.total += latency;
+}
+
+// 'H' + レイヤー番号 + ヒストグラム（レイヤーごと、最後にmatrix_scan_user）、'T' + 番号 + 記録（古い順）、
+// 'C' + 番号 + キーコードとヒストグラム（最後はそれ以外のキーコード）、'K' + 処理の番号 + 回数と時間、
+// 'I' + 0 + 省電力からの復帰の回数と遅れを送る
+void trace_dump(void) {
+    uint8_t packet[TRACE_PACKET];
+
+    for (uint8_t layer = 0; layer <= TRACE_LAYERS; layer++) {
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 'H';
+        packet[1] = layer;
+        memcpy(&packet[2], layer < TRACE_LAYERS ? trace_key_hist[layer] : trace_scan_hist, sizeof(trace_scan_hist));
+        raw_hid_send(packet, sizeof(packet));
+    }
+    for (uint8_t i = 0; i < TRACE_SIZE; i++) {
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 'T';
+        packet[1] = i;
+        memcpy(&packet[2], &trace_buf[(trace_head + i) % TRACE_SIZE], sizeof(trace_entry_t));
+        raw_hid_send(packet, sizeof(packet));
+    }
+    for (uint8_t i = 0; i <= TRACE_KEYCODES; i++) {
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 'C';
+        packet[1] = i;
+        memcpy(&packet[2], &trace_keycode_hist[i], sizeof(trace_keycode_hist_t));
+        raw_hid_send(packet, sizeof(packet));
+    }
+    for (uint8_t i = 0; i < KH_COUNT; i++) {
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 'K';
+        packet[1] = i;
+        memcpy(&packet[2], &key_handler_stats[i], sizeof(key_handler_stat_t));
+        raw_hid_send(packet, sizeof(packet));
+    }
+    memset(packet, 0, sizeof(packet));
+    packet[0] = 'I';
+    memcpy(&packet[2], &trace_wake_stat, sizeof(trace_wake_stat));
+    raw_hid_send(packet, sizeof(packet));
+}
+
+#endif
+
+#ifdef KEYTRACE_ENABLE
+// キー入力の記録  実際のタイピングの時間間隔でタップ/ホールドやシフト変換の処理を試すため
+// AdjustレイヤーのRecで記録を開始/停止し、Raw HIDで'R'を送ると読み出せる
+//
+// 記録の形式  1イベントごとに次の順で並ぶ
+//   時間差  前のイベントからの時間(ms)  下位から7bitずつ、続きがあるバイトは最上位ビットを立てる
+//           65535は1分以上の間隔
+//   状態    bit7: 押した=1/離した=0  bit6-4: 最上位のレイヤー  bit2-0: キーの種類（enum keytrace_classes）
+//   位置    種類がKT_EXACTの時だけ  行 << 4 | 列
+// 入力した内容が分からないよう、文字、数字、記号などはどのキーかを残さず種類だけを記録する
+// 位置を残すのは再生に必要なキー（シフト、タップ/ホールド、レイヤー、独自のキーコード）だけ
+// 再生するには、位置をevent.key、時間差の累計をevent.timeにしたkeyrecord_tを順にprocess_record_userに渡す
+// 種類だけのキーは、そのレイヤーでその種類になる好きな位置に割り当てる（タップ/ホールドやシフト変換は文字を区別しない）
+// 同じ種類のキーが重なって押されている場合、どれを先に離したかは残らないので、押した順に離したものとして扱う
+// バッファがいっぱいになると古いイベントから捨てる  そのため先頭のイベントの時間差は捨てたイベントからのもの
+enum keytrace_classes {
+  KT_EXACT,                          // 位置を記録するキー
+  KT_LETTER,                         // A〜Z
+  KT_DIGIT,                          // 0〜9（テンキーも）
+  KT_SYMBOL,                         // 記号、スペース、Enter、Backspaceなど  シフト付きの数字も
+  KT_MODIFIER,                       // シフト以外の修飾キー
+  KT_OTHER                           // 移動、ファンクション、メディアキーなど
+};
+#define KEYTRACE_EVENT_MAX 5         // 1イベントの最大バイト数
+#define KEYTRACE_PACKET    32        // Raw HIDのパケットサイズ
+
+static uint8_t  keytrace_buf[KEYTRACE_SIZE];
+static uint16_t keytrace_tail;       // 一番古いイベントの位置
+static uint16_t keytrace_len;
+static bool     keytrace_on = false;
+static uint16_t keytrace_last_time;  // 前のイベントの時刻
+static uint32_t keytrace_last_time32;
+
+void keytrace_toggle(void) {
+    keytrace_on = !keytrace_on;
+    if (keytrace_on) {               // 前の記録は消す
+        keytrace_tail = 0;
+        keytrace_len = 0;
+        keytrace_last_time = timer_read();
+        keytrace_last_time32 = timer_read32();
+    }
+}
+
+static uint8_t keytrace_class(uint16_t keycode) {
+    if (keycode == KC_LSFT || keycode == KC_RSFT || keycode > QK_MODS_MAX) {
+        return KT_EXACT;             // シフト、LT/MT/MO、SAFE_RANGEからのキーなど
+    }
+    uint8_t code = keycode & 0xFF;   // 修飾キー付きのキーコードは元のキーで分ける
+    if (code >= KC_A && code <= KC_Z) return KT_LETTER;
+    if ((code >= KC_1 && code <= KC_0) || (code >= KC_P1 && code <= KC_P0)) {
+        return (keycode & QK_LSFT) ? KT_SYMBOL : KT_DIGIT;
+    }
+    if ((code >= KC_ENT && code <= KC_SLSH) || (code >= KC_PSLS && code <= KC_PDOT) ||
+        code == KC_PEQL || (code >= KC_INT1 && code <= KC_INT9)) {
+        return KT_SYMBOL;
+    }
+    if (code >= KC_LCTL && code <= KC_RGUI) return KT_MODIFIER;
+    return KT_OTHER;
+}
+
+static void keytrace_drop_oldest(void) {
+    while (keytrace_buf[keytrace_tail] & 0x80) {     // 時間差の続き
+        keytrace_tail = (keytrace_tail + 1) % KEYTRACE_SIZE;
+        keytrace_len--;
+    }
+    keytrace_tail = (keytrace_tail + 1) % KEYTRACE_SIZE;   // 時間差の最後
+    uint8_t size = ((keytrace_buf[keytrace_tail] & 0x07) == KT_EXACT) ? 2 : 1;   // 状態（と位置）
+    keytrace_tail = (keytrace_tail + size) % KEYTRACE_SIZE;
+    keytrace_len -= 1 + size;
+}
+
+void keytrace_record(uint16_t keycode, keyrecord_t *record) {
+    uint8_t event[KEYTRACE_EVENT_MAX];
+    uint8_t len = 0;
+    uint16_t delta;
+    uint8_t class;
+
+    if (!keytrace_on || keycode == REC_TGL) return;
+
+    delta = TIMER_DIFF_16(record->event.time, keytrace_last_time);
+    if (timer_elapsed32(keytrace_last_time32) > UINT16_MAX) delta = UINT16_MAX;
+    keytrace_last_time = record->event.time;
+    keytrace_last_time32 = timer_read32();
+
+    do {
+        event[len] = delta & 0x7F;
+        delta >>= 7;
+        if (delta) event[len] |= 0x80;
+        len++;
+    } while (delta);
+    class = keytrace_class(keycode);
+    event[len++] = (record->event.pressed ? 0x80 : 0) |
+                   ((biton32(layer_state | default_layer_state) & 0x07) << 4) | class;
+    if (class == KT_EXACT) {
+        event[len++] = (record->event.key.row << 4) | (record->event.key.col & 0x0F);
+    }
+
+    while (keytrace_len + len > KEYTRACE_SIZE) {
+        keytrace_drop_oldest();
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        keytrace_buf[(keytrace_tail + keytrace_len) % KEYTRACE_SIZE] = event[i];
+        keytrace_len++;
+    }
+}
+
+// 'R' + 番号 + バイト数 + 記録（古い順）を送る  バイト数0のパケットで終わり
+void keytrace_dump(void) {
+    uint8_t packet[KEYTRACE_PACKET];
+    uint16_t pos = keytrace_tail;
+    uint16_t left = keytrace_len;
+    uint8_t seq = 0;
+    uint8_t n;
+
+    do {
+        n = (left < KEYTRACE_PACKET - 3) ? left : KEYTRACE_PACKET - 3;
+        memset(packet, 0, sizeof(packet));
+        packet[0] = 'R';
+        packet[1] = seq++;
+        packet[2] = n;
+        for (uint8_t i = 0; i < n; i++) {
+            packet[3 + i] = keytrace_buf[pos];
+            pos = (pos + 1) % KEYTRACE_SIZE;
+        }
+        left -= n;
+        raw_hid_send(packet, sizeof(packet));
+    } while (n > 0);
+}
+#endif
+
+#if defined(LATENCY_TRACE_ENABLE) || defined(KEYTRACE_ENABLE)
+// Raw HIDでコマンドを受け取った時
+void raw_hid_receive(uint8_t *data, uint8_t length) {
+    #ifdef LATENCY_TRACE_ENABLE
+    if (length > 0 && data[0] == 'L') {
+        trace_dump();
+    }
+    #endif
+    #ifdef KEYTRACE_ENABLE
+    if (length > 0 && data[0] == 'R') {
+        keytrace_dump();
+    }
+    #endif
 }
+#endif
 
 // サウンド設定
 #ifdef AUDIO_ENABLE
@@ -214,6 +889,83 @@ void matrix_init_user(void) {
   float adjust_on_song[][2]      = SONG(ADJUST_ON_SOUND);       // Adjustキーon
   float adjust_off_song[][2]     = SONG(ADJUST_OFF_SOUND);      // Adjustキーoff
   float push_song[][2]           = SONG(PUSH_SOUND);            // 汎用
+  #ifdef DEFAULT_LAYER_SONGS
+  extern float default_layer_songs[][16][2];                    // デフォルトレイヤーの切り替え（quantum.c）
+  #endif
+
+// 曲の予約  キーの処理中は予約だけして、メインループで鳴らす
+// 同じ曲の予約はまとめ、優先度の高い曲は鳴っている曲を止めて鳴らす
+enum user_songs {
+  SONG_LAYER_LOCK_ON,
+  SONG_LAYER_LOCK_OFF,
+  SONG_CAPS_LOCK,
+  SONG_ADJUST_ON,
+  SONG_ADJUST_OFF,
+  SONG_PUSH,
+  #ifdef DEFAULT_LAYER_SONGS
+  SONG_DEFAULT_JIS,
+  SONG_DEFAULT_US,
+  #endif
+  SONG_COUNT
+};
+typedef struct {
+    float (*notes)[][2];
+    uint8_t count;
+    uint8_t priority;                // 大きいほど優先
+} user_song_t;
+#define USER_SONG(song, prio) { (float (*)[][2])&song, NOTE_ARRAY_SIZE(song), prio }
+const user_song_t user_songs[] = {
+    [SONG_LAYER_LOCK_ON]  = USER_SONG(layer_lock_on_song,  3),
+    [SONG_LAYER_LOCK_OFF] = USER_SONG(layer_lock_off_song, 3),
+    [SONG_CAPS_LOCK]      = USER_SONG(caps_lock_song,      2),
+    [SONG_ADJUST_ON]      = USER_SONG(adjust_on_song,      2),
+    [SONG_ADJUST_OFF]     = USER_SONG(adjust_off_song,     2),
+    [SONG_PUSH]           = USER_SONG(push_song,           1),
+    #ifdef DEFAULT_LAYER_SONGS
+    [SONG_DEFAULT_JIS]    = USER_SONG(default_layer_songs[_JIS], 2),
+    [SONG_DEFAULT_US]     = USER_SONG(default_layer_songs[_US],  2),
+    #endif
+};
+
+#define SONG_QUEUE_SIZE 4
+static uint8_t song_queue[SONG_QUEUE_SIZE];   // 優先度の高い順
+static uint8_t song_queue_len = 0;
+static uint8_t song_playing = SONG_COUNT;     // 鳴っている曲  SONG_COUNTは起動音など予約以外の曲
+
+void song_request(uint8_t song) {
+    uint8_t i;
+    if (is_playing_notes() && song_playing == song) return;   // 鳴っている曲と同じなら鳴らし直さない
+    for (i = 0; i < song_queue_len; i++) {
+        if (song_queue[i] == song) return;           // 予約済みの曲とまとめる
+    }
+    if (song_queue_len == SONG_QUEUE_SIZE) {         // いっぱいなら一番優先度の低い曲を捨てる
+        if (user_songs[song_queue[SONG_QUEUE_SIZE - 1]].priority >= user_songs[song].priority) return;
+        song_queue_len--;
+    }
+    for (i = song_queue_len; i > 0 && user_songs[song_queue[i - 1]].priority < user_songs[song].priority; i--) {
+        song_queue[i] = song_queue[i - 1];
+    }
+    song_queue[i] = song;
+    song_queue_len++;
+}
+
+void song_task(void) {
+    if (!is_playing_notes()) {       // 鳴り終わったら忘れる（この後に鳴る起動音などを予約した曲と間違えないように）
+        song_playing = SONG_COUNT;
+    }
+    if (song_queue_len == 0) return;
+    const user_song_t *next = &user_songs[song_queue[0]];
+    if (is_playing_notes()) {        // 予約以外の曲（AU_ON、MU_ONなど）は一番優先度が高いとみなして止めない
+        if (song_playing == SONG_COUNT || next->priority <= user_songs[song_playing].priority) return;
+        stop_all_notes();
+    }
+    play_notes(next->notes, next->count, false);
+    song_playing = song_queue[0];
+    song_queue_len--;
+    for (uint8_t i = 0; i < song_queue_len; i++) {
+        song_queue[i] = song_queue[i + 1];
+    }
+}
 #endif
 
 // LED点灯 & Breathing
@@ -237,234 +989,879 @@ void led_breathing_off(void) {
     #endif
     backlight_disable();
 }
+
+// レイヤーごとのLEDの表示  キーの処理中はどの表示にするかだけ決め、実際の変更はメインループで変化があった時だけ行う
+enum led_effects {
+  LED_OFF,
+  LED_LOWER,
+  LED_RAISE,
+  LED_FUNC1,
+  LED_FUNC2
+};
+typedef struct {
+    uint8_t period;
+    bool    breathing;               // falseなら1回だけ点滅
+} led_effect_t;
+const led_effect_t PROGMEM led_effect_table[] = {
+    [LED_LOWER] = { 4, true  },
+    [LED_RAISE] = { 1, false },
+    [LED_FUNC1] = { 6, true  },
+    [LED_FUNC2] = { 2, true  },
+};
+static uint8_t led_wanted  = LED_OFF;   // 表示したいもの
+static uint8_t led_current = LED_OFF;   // 表示中のもの
+
+// Lower/Raiseが優先
+uint8_t led_effect_for(uint32_t state) {
+    if (state & (1UL << _LOWER)) return LED_LOWER;
+    if (state & (1UL << _RAISE)) return LED_RAISE;
+    if (state & (1UL << _FUNC2)) return LED_FUNC2;
+    if (state & (1UL << _FUNC1)) return LED_FUNC1;
+    return LED_OFF;
+}
+
+void led_task(void) {
+    if (led_wanted == led_current) return;
+    led_current = led_wanted;
+    if (led_current == LED_OFF) {
+        led_breathing_off();
+    } else {
+        led_breathing_on(pgm_read_byte(&led_effect_table[led_current].period),
+                         pgm_read_byte(&led_effect_table[led_current].breathing));
+    }
+}
+#endif
+
+// シフト変換したキーの送信
+#define SHIFT_MODS (MOD_BIT(KC_LSFT) | MOD_BIT(KC_RSFT))
+// modsを置き換えてキーを押すレポートと、キーを離して元のmodsに戻すレポートの2回だけ送る
+// （register_code/unregister_codeを並べるとmodsの変更ごとにレポートが送られる）
+void tap_code_with_mods(uint8_t code, uint8_t mods) {
+    uint8_t saved_mods = get_mods();
+    set_mods(mods);
+    add_key(code);
+    send_keyboard_report();
+    del_key(code);
+    set_mods(saved_mods);
+    send_keyboard_report();
+}
+
+// US配列の記号をJIS配列で認識させた時のキーコードに変換するテーブル
+// [US配列のキーコード - KC_1] = { シフトなし, シフトあり }  0は変換しない
+typedef struct {
+    uint16_t plain;
+    uint16_t shifted;
+} jis_shift_t;
+const jis_shift_t PROGMEM us_to_jis[KC_SLSH - KC_1 + 1] = {
+    [KC_2    - KC_1] = { KC_2,    JP_AT   },  // 2 @
+    [KC_6    - KC_1] = { KC_6,    JP_CIRC },  // 6 ^
+    [KC_7    - KC_1] = { KC_7,    JP_AMPR },  // 7 &
+    [KC_8    - KC_1] = { KC_8,    JP_ASTR },  // 8 *
+    [KC_9    - KC_1] = { KC_9,    JP_LPRN },  // 9 (
+    [KC_0    - KC_1] = { KC_0,    JP_RPRN },  // 0 )
+    [KC_MINS - KC_1] = { KC_MINS, JP_UNDS },  // - _
+    [KC_EQL  - KC_1] = { JP_EQL,  JP_PLUS },  // = +
+    [KC_LBRC - KC_1] = { JP_LBRC, JP_LCBR },  // [ {
+    [KC_RBRC - KC_1] = { JP_RBRC, JP_RCBR },  // ] }
+    [KC_BSLS - KC_1] = { JP_YEN,  JP_PIPE },  // \ |
+    [KC_SCLN - KC_1] = { JP_SCLN, JP_COLN },  // ; :
+    [KC_QUOT - KC_1] = { JP_QUOT, JP_DQT  },  // ' "
+    [KC_GRV  - KC_1] = { JP_GRV,  JP_TILD },  // ` ~
+};
+
+// US配列のキーをJIS配列用のキーとmodsに変換（変換しなくても正しく出力されるキーはfalseを返す）
+bool us_to_jis_code(uint8_t code, bool shifted, uint8_t *out_code, uint8_t *out_mods) {
+    if (code < KC_1 || code > KC_SLSH) return false;
+    const jis_shift_t *entry = &us_to_jis[code - KC_1];
+    uint16_t out = pgm_read_word(shifted ? &entry->shifted : &entry->plain);
+    if (!out || out == (shifted ? LSFT(code) : code)) return false;
+
+    uint8_t mods = get_mods();
+    *out_mods = mods & ~SHIFT_MODS;
+    if (out & QK_LSFT) {                   // 押されているシフトキーがあればそれを使う
+        *out_mods |= (mods & SHIFT_MODS) ? (mods & SHIFT_MODS) : MOD_BIT(KC_LSFT);
+    }
+    *out_code = out & 0xFF;
+    return true;
+}
+
+// US配列のキーをJIS配列用に変換してタップ
+bool tap_us_on_jis(uint8_t code, bool shifted) {
+    uint8_t out_code, out_mods;
+    if (!us_to_jis_code(code, shifted, &out_code, &out_mods)) return false;
+    tap_code_with_mods(out_code, out_mods);
+    return true;
+}
+
+// 変換して押しているキー  キーリピートさせるため、離すまでmodsを置き換えたままにする
+// 他のキーを押すと変換したキーは離したことにする（置き換えたmodsが次のキーに付かないように）
+// そのためprocess_us_on_jisで見るmodsは常に実際に押しているmods
+static struct {
+    uint8_t  code;                   // 送信しているキー  0なら押していない
+    keypos_t key;
+    uint8_t  added;                  // 押している間だけ足したmods
+    uint8_t  removed;                // 押している間だけ外したmods  離した時に戻す
+} jis_held;
+
+void release_us_on_jis(void) {
+    if (!jis_held.code) return;
+    del_key(jis_held.code);
+    set_mods((get_mods() & ~jis_held.added) | jis_held.removed);
+    send_keyboard_report();
+    jis_held.code = 0;
+}
+
+bool press_us_on_jis(uint8_t code, bool shifted, keypos_t key) {
+    uint8_t out_code, out_mods;
+    if (!us_to_jis_code(code, shifted, &out_code, &out_mods)) return false;
+    release_us_on_jis();
+    uint8_t mods = get_mods();
+    jis_held.code    = out_code;
+    jis_held.key     = key;
+    jis_held.added   = out_mods & ~mods;
+    jis_held.removed = mods & ~out_mods;
+    set_mods(out_mods);
+    add_key(out_code);
+    send_keyboard_report();
+    return true;
+}
+
+// JISレイヤーでのシフト変換  変換して送信したキーはfalseを返す
+// 変換したキーは離すまで押したままにする（キーリピートする）
+bool process_us_on_jis(uint16_t keycode, keyrecord_t *record) {
+    static matrix_row_t jis_pressed[MATRIX_ROWS];  // 変換して押したキー（離した時の処理を止める）
+    keypos_t key = record->event.key;
+    matrix_row_t bit = (matrix_row_t)1 << key.col;
+
+    if (jis_held.code && !record->event.pressed && (keycode == KC_LSFT || keycode == KC_RSFT || keycode == SFT_JQT)) {
+        // 変換キーを押している間に離したシフトキーは、変換キーを離した時に戻さない
+        jis_held.removed &= ~((keycode == KC_LSFT) ? MOD_BIT(KC_LSFT) : MOD_BIT(KC_RSFT));
+        return true;
+    }
+    if (!record->event.pressed) {
+        if (jis_pressed[key.row] & bit) {
+            jis_pressed[key.row] &= ~bit;
+            if (jis_held.code && jis_held.key.row == key.row && jis_held.key.col == key.col) {
+                release_us_on_jis();
+            }
+            return false;
+        }
+        return true;
+    }
+    if (keycode > 0xFF && (keycode & 0xFF00) != QK_LSFT) return true;   // 基本キーとShift+基本キーだけ
+    if (press_us_on_jis(keycode & 0xFF, (get_mods() & SHIFT_MODS) || (keycode & QK_LSFT), key)) {
+        jis_pressed[key.row] |= bit;
+        return false;
+    }
+    return true;
+}
+
+#if defined(MOUSEKEY_ENABLE) && defined(MOUSEKEY_INERTIA)
+// マウスキー  速度を固定小数点（1/256ピクセル単位）で加速・減速させ、1ピクセル未満の移動は次に持ち越す
+// 移動した時とボタンが変わった時だけレポートを送る
+typedef struct {
+    int16_t velocity;                // 1回あたりの移動量(1/256ピクセル)
+    int16_t remainder;               // 持ち越した1ピクセル未満の移動
+} mk_axis_t;
+
+static mk_axis_t mk_x, mk_y, mk_v, mk_h;
+static uint16_t  mk_keys;            // 押されているマウスキー（KC_MS_UPからの順番のビット）
+static uint16_t  mk_timer;
+
+#define MK_KEY(kc)          ((uint16_t)1 << ((kc) - KC_MS_UP))
+#define MK_DIR(plus, minus) (((mk_keys & MK_KEY(plus)) ? 1 : 0) - ((mk_keys & MK_KEY(minus)) ? 1 : 0))
+
+int8_t mk_axis_step(mk_axis_t *axis, int8_t dir, int16_t accel, int16_t max) {
+    if (dir) {
+        // 止まっていたか逆向きに押したら、最初の1回で必ず1単位動かす（短いタップでも動く）
+        if (axis->velocity == 0 || (axis->velocity > 0) != (dir > 0)) {
+            axis->velocity = 0;
+            axis->remainder = dir * 256;
+        }
+        axis->velocity += dir * accel;
+        if (axis->velocity > max)  axis->velocity = max;
+        if (axis->velocity < -max) axis->velocity = -max;
+    } else if (axis->velocity) {     // 離したら少しずつ減速
+        axis->velocity -= axis->velocity / 4;
+        if (axis->velocity > -16 && axis->velocity < 16) {   // 止まる時は持ち越した分を四捨五入して動かす
+            axis->velocity = 0;
+            axis->remainder += (axis->remainder < 0) ? -128 : 128;
+        }
+    } else {
+        axis->remainder = 0;
+    }
+    axis->remainder += axis->velocity;
+    int8_t delta = axis->remainder / 256;
+    axis->remainder -= delta * 256;
+    return delta;
+}
+
+uint8_t mk_buttons(void) {
+    return (mk_keys >> (KC_MS_BTN1 - KC_MS_UP)) & 0x1F;
+}
+
+void mouse_inertia_task(void) {
+    if (timer_elapsed(mk_timer) < MK_INERTIA_INTERVAL) return;
+    mk_timer = timer_read();
+
+    int8_t dx = MK_DIR(KC_MS_RIGHT, KC_MS_LEFT);
+    int8_t dy = MK_DIR(KC_MS_DOWN, KC_MS_UP);
+    int16_t max = MK_INERTIA_MAX;
+    if (mk_keys & MK_KEY(KC_MS_ACCEL0)) {          // ACL0は1/4、ACL1は1/2の速さまで
+        max /= 4;
+    } else if (mk_keys & MK_KEY(KC_MS_ACCEL1)) {
+        max /= 2;
+    }
+    if (dx && dy) {                  // 斜めは各軸を1/√2にして速さをそろえる
+        max = ((int32_t)max * 181) >> 8;
+    }
+
+    report_mouse_t report = { .buttons = mk_buttons() };
+    report.x = mk_axis_step(&mk_x, dx, MK_INERTIA_ACCEL, max);
+    report.y = mk_axis_step(&mk_y, dy, MK_INERTIA_ACCEL, max);
+    report.v = mk_axis_step(&mk_v, MK_DIR(KC_MS_WH_UP, KC_MS_WH_DOWN), MK_INERTIA_WHEEL_ACCEL, MK_INERTIA_WHEEL_MAX);
+    report.h = mk_axis_step(&mk_h, MK_DIR(KC_MS_WH_RIGHT, KC_MS_WH_LEFT), MK_INERTIA_WHEEL_ACCEL, MK_INERTIA_WHEEL_MAX);
+    if (report.x || report.y || report.v || report.h) {
+        host_mouse_send(&report);
+    }
+}
+
+// マウスキーが押された時  ボタンはすぐにレポートを送る
+bool process_mouse_inertia(uint16_t keycode, keyrecord_t *record) {
+    if (keycode < KC_MS_UP || keycode > KC_MS_ACCEL2) return true;
+    if (record->event.pressed) {
+        mk_keys |= MK_KEY(keycode);
+        if (keycode < KC_MS_BTN1 || (keycode >= KC_MS_WH_UP && keycode <= KC_MS_WH_RIGHT)) {
+            mk_timer = timer_read() - MK_INERTIA_INTERVAL;   // 移動キーは次のスキャンですぐに動かす
+        }
+    } else {
+        mk_keys &= ~MK_KEY(keycode);
+    }
+    if (keycode >= KC_MS_BTN1 && keycode <= KC_MS_BTN5) {
+        report_mouse_t report = { .buttons = mk_buttons() };
+        host_mouse_send(&report);
+    }
+    return false;
+}
+#endif
+
+// Lower/Raiseレイヤーのマスク
+#define LR_LAYERS_MASK ((1UL << _LOWER) | (1UL << _RAISE))
+static uint32_t lr_layers_on;         // onになっているLower/Raiseレイヤー（レイヤー変更時に更新）
+
+// レイヤー変更時に呼ばれる
+uint32_t layer_state_set_user(uint32_t state) {
+    lr_layers_on = state & LR_LAYERS_MASK;
+    #ifdef BACKLIGHT_ENABLE
+      led_wanted = led_effect_for(state);
+    #endif
+    #ifdef KEYCODE_CACHE
+      keycode_cache_build(state | default_layer_state);
+    #endif
+    return state;
+}
+
+#ifdef KEYCODE_CACHE
+// デフォルトレイヤー変更時に呼ばれる
+uint32_t default_layer_state_set_user(uint32_t state) {
+    keycode_cache_build(layer_state | state);
+    return state;
+}
 #endif
 
 // レイヤー初期化
 void init_layer(void) {
     layer_off(_LOWER);
     layer_off(_RAISE);
-    #ifdef BACKLIGHT_ENABLE
-      led_breathing_off();
-    #endif
 }
 
-// 特殊キーが押された時の動作
-bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+// 無操作時の省電力  一定時間キー操作がなければLEDとサウンドを止め、さらに経つとスキャンの間隔を空ける
+// スキャンのたびにキーが押されていないか確認し、押されていればそのスキャンのうちに元に戻す
+enum idle_levels {
+  IDLE_ACTIVE,
+  IDLE_QUIET,                        // LEDとサウンドを停止
+  IDLE_SLOW_SCAN                     // さらにスキャンの間隔を空け、その間CPUを止める（AVRのみ）
+};
+static uint8_t  idle_level = IDLE_ACTIVE;
+static uint32_t idle_timer;          // 最後にキーを操作した時刻
+#ifdef LATENCY_TRACE_ENABLE
+static uint16_t idle_sleep_time;     // 最後にidle_sleep_msに入った時刻
+static uint16_t idle_wake_time;      // 復帰の遅れを測り始める時刻
+static bool     idle_waking = false; // 復帰してから最初のキーを処理するまで
+#endif
 
-    static uint16_t custom_timer;
-    static uint8_t prev_shift;
-    static bool lshift = false;
-    static bool rshift = false;
-    static uint8_t dl;
-    static uint8_t l_r_layer;
+void idle_activity(void) {
+    idle_timer = timer_read32();
+}
 
-  switch (keycode) {
-    case JIS:                               // デフォルトレイヤーをJISに切り替え
-      if (record->event.pressed) {
-        init_layer();
-        set_single_persistent_default_layer(_JIS);
+// CPUを止めて待つ  アイドルスリープではタイマー0（1msごと）とUSBの割り込みで起きる
+// wait_msはCPUを回し続けるので電力が減らない
+void idle_sleep_ms(uint8_t ms) {
+    #ifdef LATENCY_TRACE_ENABLE
+      idle_sleep_time = timer_read();
+    #endif
+    #ifdef __AVR__
+      uint16_t start = timer_read();
+      set_sleep_mode(SLEEP_MODE_IDLE);
+      while (timer_elapsed(start) < ms) {
+          sleep_enable();
+          sleep_cpu();
+          sleep_disable();
       }
-      return false;
-      break;
-    case US:                                // デフォルトレイヤーをUSに切り替え
-      if (record->event.pressed) {
-        init_layer();
-        set_single_persistent_default_layer(_US);
+    #endif
+}
+
+bool idle_any_key_pressed(void) {
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (matrix_get_row(row)) return true;
+    }
+    return false;
+}
+
+void idle_task(void) {
+    if (idle_level != IDLE_ACTIVE && idle_any_key_pressed()) {
+        #ifdef LATENCY_TRACE_ENABLE
+          // 止まっている間に押されたキーは、最後に止まった時からこのスキャンまで待たされている
+          idle_wake_time = (idle_level == IDLE_SLOW_SCAN) ? idle_sleep_time : timer_read();
+          idle_waking = true;
+        #endif
+        idle_level = IDLE_ACTIVE;    // LEDはled_taskで元に戻る
+        idle_activity();
+        return;
+    }
+    uint32_t elapsed = timer_elapsed32(idle_timer);
+    if (idle_level == IDLE_ACTIVE && elapsed > IDLE_QUIET_TIME) {
+        idle_level = IDLE_QUIET;
+        #ifdef BACKLIGHT_ENABLE
+          led_breathing_off();
+          led_current = LED_OFF;
+        #endif
+        #ifdef AUDIO_ENABLE
+          stop_all_notes();
+          song_queue_len = 0;
+        #endif
+    } else if (idle_level == IDLE_QUIET && elapsed > IDLE_SLOW_SCAN_TIME) {
+        idle_level = IDLE_SLOW_SCAN;
+    }
+    if (idle_level == IDLE_SLOW_SCAN) {
+        idle_sleep_ms(IDLE_SCAN_INTERVAL);
+    }
+}
+
+// 復帰して最初のキーの遅れ  キーを見つけたスキャンの前の最後のidle_sleep_msの開始から、そのキーの処理までの時間
+// LATENCY_TRACE_ENABLEの時、Raw HIDの'L'で読み出せる（trace_dumpの'I'）
+void idle_key_processed(keyrecord_t *record) {
+    #ifdef LATENCY_TRACE_ENABLE
+      if (idle_waking && record->event.pressed) {
+          idle_waking = false;
+          trace_wake_record(timer_elapsed(idle_wake_time));
       }
-      return false;
-      break;
-    case TGL_LOW:                           // Lower/Raiseにトグル
-    case TGL_RIS:
-      if (record->event.pressed) {
-        dl = biton32(default_layer_state);
-        if (keycode == TGL_LOW){
-            l_r_layer = _LOWER;
-        } else if (keycode == TGL_RIS){
-            if(dl == _JIS){
-               l_r_layer = _RAISE;
-            } else if (dl == _US) {
-               l_r_layer = _RAISE_US;
-            }
+    #endif
+    idle_activity();
+}
+
+// メインループ
+void matrix_scan_user(void) {
+    #ifdef LATENCY_TRACE_ENABLE
+      uint16_t start = trace_clock();
+    #endif
+    idle_task();
+    host_detect_task();
+    macro_task();
+    settings_task();
+    if (idle_level == IDLE_ACTIVE) {
+        #ifdef BACKLIGHT_ENABLE
+          led_task();
+        #endif
+        #ifdef AUDIO_ENABLE
+          song_task();
+        #endif
+    }
+    #if defined(MOUSEKEY_ENABLE) && defined(MOUSEKEY_INERTIA)
+      mouse_inertia_task();
+    #endif
+    #ifdef LATENCY_TRACE_ENABLE
+      trace_hist_add(trace_scan_hist, trace_clock() - start);
+    #endif
+}
+
+// IMEキーを送る  on: 「かな」「変換」  off: 「英数」「無変換」
+void tap_ime(bool on) {
+    uint8_t host = ime_host();
+    if (host != HOST_MAC) {
+        register_code(on ? KC_HENK : KC_MHEN);
+        unregister_code(on ? KC_HENK : KC_MHEN);
+    }
+    if (host != HOST_WIN) {
+        register_code(on ? KC_LANG1 : KC_LANG2);
+        unregister_code(on ? KC_LANG1 : KC_LANG2);
+    }
+}
+
+// タップ/ホールド判定（Lower/Raiseキー、SFT_JQT）
+// 押した瞬間にレイヤーやShiftをonにし、離した時にタップだったと分かればタップの動作をする
+// 押している間に他のキーが押されたらホールドに決定（他のキーはすでにレイヤーやShiftがonの状態で入力されている）
+typedef struct {
+    uint16_t timer;                  // 押した時刻
+    uint16_t term;                   // タップとみなす時間(ms)
+    uint8_t  tap_dev;                // タップの押下時間のばらつき(ms)
+    bool     pressed;                // 押されていてまだタップかホールドか決まっていない
+    bool     interrupted;            // 押している間に他のキーが押された（ホールドに決定）
+} tap_hold_t;
+
+static tap_hold_t tap_hold_keys[TH_COUNT] = {
+    [TH_LOWER]   = { .term = LOWER_TAPPING_TERM },
+    [TH_RAISE]   = { .term = RAISE_TAPPING_TERM },
+    [TH_SFT_JQT] = { .term = TAPPING_TERM },
+};
+
+#ifdef ADAPTIVE_TAPPING_TERM
+// タップと判定した押下の時間から、タップとみなす時間を学習する
+// （ホールドやキャンセルと判定した押下を学習に入れると、タップとみなす時間が伸び続けてしまう）
+// 平均とばらつきの移動平均を取り、「平均 + ばらつき×4」をタップとみなす時間にする
+void tap_hold_update_term(uint8_t index) {
+    tap_hold_t *th = &tap_hold_keys[index];
+    uint16_t term = user_config.tap_avg[index] + 4 * th->tap_dev;
+    if (term < ADAPTIVE_TERM_MIN) term = ADAPTIVE_TERM_MIN;
+    if (term > ADAPTIVE_TERM_MAX) term = ADAPTIVE_TERM_MAX;
+    th->term = term;
+}
+
+static uint8_t saved_tap_avg[TH_COUNT];  // EEPROMに保存済みの値
+
+void tap_hold_learn(uint8_t index, uint16_t elapsed) {
+    tap_hold_t *th = &tap_hold_keys[index];
+    int16_t avg = user_config.tap_avg[index];
+
+    if (avg == 0) {                  // 最初の1回
+        avg = elapsed;
+        th->tap_dev = elapsed / 2;
+    } else {
+        int16_t diff = (int16_t)elapsed - avg;
+        avg += diff / 8;
+        th->tap_dev += ((diff < 0 ? -diff : diff) - th->tap_dev) / 4;
+    }
+    user_config.tap_avg[index] = avg ? avg : 1;
+    tap_hold_update_term(index);
+
+    // 平均が一定以上変わった時だけ保存する
+    int16_t step = (int16_t)user_config.tap_avg[index] - saved_tap_avg[index];
+    if (step >= ADAPTIVE_TERM_SAVE_STEP || step <= -ADAPTIVE_TERM_SAVE_STEP) {
+        saved_tap_avg[index] = user_config.tap_avg[index];
+        settings_save();
+    }
+}
+
+// EEPROMから読んだ学習結果を反映する
+void tap_hold_init(void) {
+    for (uint8_t i = 0; i < TH_COUNT; i++) {
+        saved_tap_avg[i] = user_config.tap_avg[i];
+        if (user_config.tap_avg[i]) {
+            tap_hold_keys[i].tap_dev = user_config.tap_avg[i] / 4;
+            tap_hold_update_term(i);
         }
-        if IS_LAYER_ON(l_r_layer){
-            layer_off(l_r_layer);
-            #ifdef BACKLIGHT_ENABLE
-              led_breathing_off();
-            #endif
-            #ifdef AUDIO_ENABLE
-              PLAY_SONG(layer_lock_off_song);
-            #endif
+    }
+}
+#endif
+
+void tap_hold_press(uint8_t index) {
+    tap_hold_t *th = &tap_hold_keys[index];
+    th->timer = timer_read();
+    th->pressed = true;
+    th->interrupted = false;
+}
+
+// 離した時にタップだったらtrueを返す
+bool tap_hold_release(uint8_t index) {
+    tap_hold_t *th = &tap_hold_keys[index];
+    if (!th->pressed) return false;  // ロック解除などに使った押下は無視
+    th->pressed = false;
+    if (th->interrupted) return false;
+
+    uint16_t elapsed = timer_elapsed(th->timer);
+    bool tap = elapsed < th->term;
+    dprintf("tap-hold %u: %s after %u ms (term %u)\n", index, tap ? "tap" : "cancel", elapsed, th->term);
+    #ifdef ADAPTIVE_TAPPING_TERM
+      if (tap) tap_hold_learn(index, elapsed);
+    #endif
+    return tap;
+}
+
+// 他のキーが押されたら、押されているキーをホールドに決定する
+void tap_hold_interrupt(void) {
+    for (uint8_t i = 0; i < TH_COUNT; i++) {
+        tap_hold_t *th = &tap_hold_keys[i];
+        if (th->pressed && !th->interrupted) {
+            th->interrupted = true;
+            dprintf("tap-hold %u: hold after %u ms\n", i, timer_elapsed(th->timer));
+        }
+    }
+}
+
+// Lower/Raiseレイヤーのロック（トグル）
+void toggle_lock_layer(uint8_t layer) {
+    if (IS_LAYER_ON(layer)) {
+        layer_off(layer);
+        #ifdef AUDIO_ENABLE
+          song_request(SONG_LAYER_LOCK_OFF);
+        #endif
+    } else {
+        layer_on(layer);
+        #ifdef AUDIO_ENABLE
+          song_request(SONG_LAYER_LOCK_ON);
+        #endif
+    }
+}
+
+// 同時押し  押されているキーの位置を48ビットのマスクで持ち、組み合わせのマスクと比較する
+// 組み合わせの最後のキーは押した時も離した時もキーとしては入力しない
+#define KEY_BIT(r, c) ((uint64_t)1 << ((r) * MATRIX_COLS + (c)))
+#define LOWER_KEY     KEY_BIT(3, 4)
+#define RAISE_KEY     KEY_BIT(3, 7)
+#define ADJUST_KEY    KEY_BIT(3, 1)
+
+enum user_combo_actions {
+  COMBO_LAYER,                       // 押している間レイヤーをon
+  COMBO_LOCK                         // レイヤーをロック（トグル）
+};
+typedef struct {
+    uint64_t keys;
+    uint16_t term;                   // 最初のキーから最後のキーまでの時間の上限(ms)  0は制限なし
+    uint8_t  action;
+    uint8_t  layer;
+} user_combo_t;
+
+static const user_combo_t user_combos[] = {
+    { LOWER_KEY  | RAISE_KEY, COMBO_TERM,  COMBO_LAYER, _ADJUST },   // Lower + Raise  Adjust（Lowerの0などを打てるよう時間を制限）
+    { ADJUST_KEY | LOWER_KEY, COMBO_TERM,  COMBO_LOCK,  _LOWER  },   // Adjust + Lower  Lowerをロック
+    { ADJUST_KEY | RAISE_KEY, COMBO_TERM,  COMBO_LOCK,  _RAISE  },   // Adjust + Raise  Raiseをロック
+};
+#define COMBO_COUNT (sizeof(user_combos) / sizeof(user_combos[0]))
+#define COMBO_ALL_KEYS (LOWER_KEY | RAISE_KEY | ADJUST_KEY)        // 組み合わせに使うキーすべて
+
+static uint64_t combo_pressed;       // 押されているキー
+static uint64_t combo_swallowed;     // 組み合わせの最後に押したキー（離した時も入力しない）
+static uint16_t combo_first_time;    // 組み合わせに使うキーを何も押していない状態から最初に押した時刻
+static bool     combo_window;        // その後に組み合わせに使わないキーを押していない
+static uint8_t  combo_held = COMBO_COUNT;   // 押している間有効な組み合わせ
+
+void user_combo_action(uint8_t index, bool pressed) {
+    const user_combo_t *combo = &user_combos[index];
+    if (combo->action == COMBO_LAYER) {
+        if (pressed) {
+            layer_on(combo->layer);
+            combo_held = index;
         } else {
-            layer_on(l_r_layer);
-            #ifdef BACKLIGHT_ENABLE
-            if (keycode == TGL_LOW){
-                led_breathing_on(4, true);
-            } else if (keycode == TGL_RIS){
-                led_breathing_on(1, false);
-            }
-            #endif
-            #ifdef AUDIO_ENABLE
-              PLAY_SONG(layer_lock_on_song);
-            #endif
+            layer_off(combo->layer);
+            combo_held = COMBO_COUNT;
         }
-      }
-      return false;
-      break;
-    case M_EMHL:                           // Lower/RaiseキーのサウンドとLED
-    case M_KHKR:
-    case M_KHRU:
-        if (record->event.pressed) {       // レイヤーがトグルされていれば、そのレイヤーをオフにしてサウンドを鳴らす
-          if (IS_LAYER_ON(_LOWER) || IS_LAYER_ON(_RAISE) || IS_LAYER_ON(_RAISE_US)){
-                if (keycode == M_EMHL){
-                    l_r_layer = _LOWER;
-                } else if (keycode == M_KHKR){
-                    l_r_layer = _RAISE;
-                } else if (keycode == M_KHRU){
-                    l_r_layer = _RAISE_US;
-                }
-            layer_off(l_r_layer);
+        #ifdef AUDIO_ENABLE
+          if (combo->layer == _ADJUST) song_request(pressed ? SONG_ADJUST_ON : SONG_ADJUST_OFF);
+        #endif
+    } else if (pressed) {
+        // Lower/Raiseキーを押している途中なら、離してもレイヤーをoffにしないことでロックする
+        tap_hold_t *th = &tap_hold_keys[combo->layer == _LOWER ? TH_LOWER : TH_RAISE];
+        if (th->pressed) {
+            th->pressed = false;
             #ifdef AUDIO_ENABLE
-              PLAY_SONG(layer_lock_off_song);
+              song_request(SONG_LAYER_LOCK_ON);
             #endif
-            return false;
-            break;
-          } else {                         // レイヤーがトグルされていなければキーが押されている間はLED点灯
-            #ifdef BACKLIGHT_ENABLE
-              if (keycode == M_EMHL){
-                  led_breathing_on(4, true);
-              } else if ((keycode == M_KHKR) || (keycode == M_KHRU)){
-                  led_breathing_on(1, false);
-              }
-            #endif
-          }
-        } else {                           // キーを離したらLED消灯
-          #ifdef BACKLIGHT_ENABLE
-            led_breathing_off();
-          #endif
+        } else {
+            toggle_lock_layer(combo->layer);
         }
-      return true;
-      break;
-    #ifdef BACKLIGHT_ENABLE
-    case FN2_TAB:                          // LED点灯／消灯
-    case FN1_ESC:
-       if (record->event.pressed) {
-        if (!(IS_LAYER_ON(_LOWER) || IS_LAYER_ON(_RAISE) || IS_LAYER_ON(_RAISE_US))){
-            if (keycode == FN2_TAB) {
-                led_breathing_on(2, true);
-            } else {
-                led_breathing_on(6, true);
-            }
+    }
+}
+
+// 組み合わせの最後のキーだったらfalseを返す
+bool process_user_combo(keyrecord_t *record) {
+    uint64_t bit = KEY_BIT(record->event.key.row, record->event.key.col);
+
+    if (!record->event.pressed) {
+        combo_pressed &= ~bit;
+        if (combo_held < COMBO_COUNT && (user_combos[combo_held].keys & bit)) {
+            user_combo_action(combo_held, false);
         }
-       } else {
-        if (!(IS_LAYER_ON(_LOWER) || IS_LAYER_ON(_RAISE) || IS_LAYER_ON(_RAISE_US))){
-          led_breathing_off();
+        if (combo_swallowed & bit) {
+            combo_swallowed &= ~bit;
+            return false;
         }
-       }
-      return true;
-      break;
-    #endif
-    case SFT_JQT:                          // 長押しでシフトキー、単押しでJISの「'」か「"」
-      if (record->event.pressed) {
-        custom_timer = timer_read();
-        prev_shift = keyboard_report->mods & (MOD_BIT(KC_LSFT) | MOD_BIT(KC_RSFT));
-        register_code (KC_RSFT);
-      } else {
-            if (timer_elapsed (custom_timer) < TAPPING_TERM) {
-                // 長押しでない場合、別のシフトキーが同時に押されていなければ「'」、押されていれば「"」を出力
-                if (prev_shift) {
-                    register_code(KC_2);
-                    unregister_code(KC_2);
-                } else {
-                    register_code(KC_7);
-                    unregister_code(KC_7);
-                }
-            }
-            unregister_code (KC_RSFT);
-      }
-      return false;
-      break;
-    case WN_SCLN:                          // JISの「;」と「:」
-      if (record->event.pressed) {
-        lshift = keyboard_report->mods & MOD_BIT(KC_LSFT);
-        rshift = keyboard_report->mods & MOD_BIT(KC_RSFT);
-        if (lshift || rshift) {
-          if (lshift) unregister_code(KC_LSFT);
-          if (rshift) unregister_code(KC_RSFT);
-          register_code(JP_COLN);
-          unregister_code(JP_COLN);
-          if (lshift) register_code(KC_LSFT);
-          if (rshift) register_code(KC_RSFT);
-        } else {
-          register_code(JP_SCLN);
-          unregister_code(JP_SCLN);
+        return true;
+    }
+
+    combo_pressed |= bit;
+    if (!(bit & COMBO_ALL_KEYS)) {   // ほとんどのキーはここで終わり
+        combo_window = false;        // 間に他のキーを押したら（ホールドに決まったら）時間制限のある組み合わせにはしない
+        return true;
+    }
+    if (!(combo_pressed & COMBO_ALL_KEYS & ~bit)) {
+        combo_first_time = record->event.time;
+        combo_window = true;
+    }
+    for (uint8_t i = 0; i < COMBO_COUNT; i++) {
+        const user_combo_t *combo = &user_combos[i];
+        if ((combo->keys & bit) && (combo_pressed & combo->keys) == combo->keys &&
+            (combo->term == 0 ||
+             (combo_window && TIMER_DIFF_16(record->event.time, combo_first_time) <= combo->term))) {
+            combo_swallowed |= bit;
+            user_combo_action(i, true);
+            return false;
         }
-      }
-      return false;
-      break;
-    case WN_CAPS:                          // Caps Lockの音を鳴らす
-      if (record->event.pressed) {
-        #ifdef AUDIO_ENABLE
-          PLAY_SONG(caps_lock_song);
-        #endif
-      }
-      return true;
-      break;
-    case BL_TOGG:                          // LED光量が変更された時に音を鳴らす
-    case BL_DEC:
-    case BL_INC:
-    case BL_STEP:
-      if (record->event.pressed) {
-        #ifdef AUDIO_ENABLE
-          PLAY_SONG(push_song);
+    }
+    return true;
+}
+
+// キーコードごとの処理  押された時も離された時も呼ばれ、falseを返すとQMKの処理を止める
+static bool handle_default_layer(uint16_t keycode, keyrecord_t *record) {   // デフォルトレイヤーをJIS/USに切り替え
+    if (record->event.pressed) {
+        init_layer();
+        set_default_layer_saved(keycode == JIS ? _JIS : _US);
+        #if defined(AUDIO_ENABLE) && defined(DEFAULT_LAYER_SONGS)
+          song_request(keycode == JIS ? SONG_DEFAULT_JIS : SONG_DEFAULT_US);
         #endif
-      }
-      return true;
-      break;
-    case ADJUST:                           // Adjustキー用の音
-      if (record->event.pressed) {
+    }
+    return false;
+}
+
+static bool handle_lock_layer(uint16_t keycode, keyrecord_t *record) {      // Lower/Raiseにトグル
+    if (record->event.pressed) {
+        toggle_lock_layer(keycode == TGL_LOW ? _LOWER : _RAISE);
+    }
+    return false;
+}
+
+static bool handle_lower_raise(uint16_t keycode, keyrecord_t *record) {     // Lower/Raiseキー  タップでIMEキー、ホールドでレイヤー
+    uint8_t layer = (keycode == M_EMHL) ? _LOWER : _RAISE;
+    uint8_t th    = (keycode == M_EMHL) ? TH_LOWER : TH_RAISE;
+
+    if (record->event.pressed) {
+        if (lr_layers_on) {            // レイヤーがトグルされていれば、そのレイヤーをオフにしてサウンドを鳴らす
+            layer_off(layer);
+            #ifdef AUDIO_ENABLE
+              song_request(SONG_LAYER_LOCK_OFF);
+            #endif
+            return false;
+        }
+        tap_hold_press(th);
+        layer_on(layer);
+    } else if (tap_hold_keys[th].pressed) {   // ロック解除に使った押下でなければ
+        layer_off(layer);
+        if (tap_hold_release(th)) {
+            tap_ime(keycode == M_KHKR);
+        }
+    }
+    return false;
+}
+
+static struct {
+    uint8_t prev_shift;                // 押した時に押されていた別のシフトキー
+} sft_jqt_state;
+
+static bool handle_sft_jqt(uint16_t keycode, keyrecord_t *record) {         // 長押しでシフトキー、単押しでJISの「'」か「"」
+    if (record->event.pressed) {
+        tap_hold_press(TH_SFT_JQT);
+        sft_jqt_state.prev_shift = keyboard_report->mods & SHIFT_MODS;
+        register_code(KC_RSFT);
+    } else if (tap_hold_release(TH_SFT_JQT)) {
+        // 長押しでない場合、別のシフトキーが同時に押されていなければ「'」、押されていれば「"」を出力
+        // キーを離すレポートで右Shiftも同時に離す
+        del_mods(MOD_BIT(KC_RSFT));
+        tap_us_on_jis(KC_QUOT, sft_jqt_state.prev_shift);
+    } else {
+        unregister_code(KC_RSFT);
+    }
+    return false;
+}
+
+static bool handle_host_os(uint16_t keycode, keyrecord_t *record) {         // IMEキーを送るOSの切り替え
+    if (record->event.pressed) {
+        user_config.host_os = (keycode == OS_MAC) ? HOST_MAC : (keycode == OS_WIN) ? HOST_WIN : HOST_AUTO;
+        settings_save();
         #ifdef AUDIO_ENABLE
-          PLAY_SONG(adjust_on_song);
+          song_request(SONG_PUSH);
         #endif
-      } else {
+    }
+    return false;
+}
+
+// マクロの文字列  MACRO_1から順に
+static const char macro_1_str[] PROGMEM = "This is a test.";
+static const char macro_2_str[] PROGMEM = "korehatesutodesu.";
+static const char macro_3_str[] PROGMEM = "sukinamojiwoiretekudasai.";
+static const char * const macro_strs[] = { macro_1_str, macro_2_str, macro_3_str };
+
+static bool handle_macro(uint16_t keycode, keyrecord_t *record) {
+    if (record->event.pressed) {
+        send_string_async(macro_strs[keycode - MACRO_1]);
+    }
+    return false;
+}
+
+#ifdef KEYTRACE_ENABLE
+static bool handle_keytrace(uint16_t keycode, keyrecord_t *record) {        // キー入力の記録を開始/停止
+    if (record->event.pressed) {
+        keytrace_toggle();
         #ifdef AUDIO_ENABLE
-            PLAY_SONG(adjust_off_song);
+          song_request(keytrace_on ? SONG_LAYER_LOCK_ON : SONG_LAYER_LOCK_OFF);
         #endif
-      }
-      return true;
-      break;
-    // 以下、マクロ
-    case MACRO_1:
-      if (record->event.pressed) {
-        SEND_STRING("This is a test.");
-      }
-      return false;
-      break;
-    case MACRO_2:
-      if (record->event.pressed) {
-        SEND_STRING("korehatesutodesu.");
-      }
-      return false;
-      break;
-    case MACRO_3:
-      if (record->event.pressed) {
-        SEND_STRING("sukinamojiwoiretekudasai.");
-      }
-      return false;
-      break;
+    }
+    return false;
+}
+#endif
+
+#ifdef AUDIO_ENABLE
+static bool handle_caps_song(uint16_t keycode, keyrecord_t *record) {       // Caps Lockの音を鳴らす
+    if (record->event.pressed) {
+        song_request(SONG_CAPS_LOCK);
+    }
+    return true;
+}
+
+static bool handle_bl_song(uint16_t keycode, keyrecord_t *record) {         // LED光量が変更された時に音を鳴らす
+    if (record->event.pressed) {
+        song_request(SONG_PUSH);
+    }
+    return true;
+}
+
+static bool handle_adjust_song(uint16_t keycode, keyrecord_t *record) {     // Adjustキー用の音
+    song_request(record->event.pressed ? SONG_ADJUST_ON : SONG_ADJUST_OFF);
+    return true;
+}
+#endif
+
+static bool (* const key_handlers[KH_COUNT])(uint16_t keycode, keyrecord_t *record) = {
+    [KH_DEFAULT_LAYER] = handle_default_layer,
+    [KH_LOCK_LAYER]    = handle_lock_layer,
+    [KH_LOWER_RAISE]   = handle_lower_raise,
+    [KH_SFT_JQT]       = handle_sft_jqt,
+    [KH_HOST_OS]       = handle_host_os,
+    [KH_MACRO]         = handle_macro,
+    #ifdef KEYTRACE_ENABLE
+    [KH_KEYTRACE]      = handle_keytrace,
+    #endif
+    #ifdef AUDIO_ENABLE
+    [KH_CAPS_SONG]     = handle_caps_song,
+    [KH_BL_SONG]       = handle_bl_song,
+    [KH_ADJUST_SONG]   = handle_adjust_song,
+    #endif
+};
+
+// SAFE_RANGEからのキーコードは表を引くだけで処理を選ぶ  書かなかったキーコードはKH_NONE
+#define KEY_HANDLER(kc, handler) [(kc) - SAFE_RANGE] = handler
+static const uint8_t PROGMEM key_handler_map[PLANCK_KEYCODES_END - SAFE_RANGE] = {
+    KEY_HANDLER(JIS,     KH_DEFAULT_LAYER),
+    KEY_HANDLER(US,      KH_DEFAULT_LAYER),
+    KEY_HANDLER(SFT_JQT, KH_SFT_JQT),
+    KEY_HANDLER(M_EMHL,  KH_LOWER_RAISE),
+    KEY_HANDLER(M_KHKR,  KH_LOWER_RAISE),
+    KEY_HANDLER(TGL_RIS, KH_LOCK_LAYER),
+    KEY_HANDLER(TGL_LOW, KH_LOCK_LAYER),
+    KEY_HANDLER(OS_AUTO, KH_HOST_OS),
+    KEY_HANDLER(OS_MAC,  KH_HOST_OS),
+    KEY_HANDLER(OS_WIN,  KH_HOST_OS),
+    #ifdef KEYTRACE_ENABLE
+    KEY_HANDLER(REC_TGL, KH_KEYTRACE),
+    #endif
+    KEY_HANDLER(MACRO_1, KH_MACRO),
+    KEY_HANDLER(MACRO_2, KH_MACRO),
+    KEY_HANDLER(MACRO_3, KH_MACRO),
+};
+
+// QMKのキーコードで処理を追加するもの  音を鳴らすだけなのでAUDIO_ENABLEの時だけ探す
+#ifdef AUDIO_ENABLE
+typedef struct {
+    uint16_t keycode;
+    uint8_t  handler;
+} key_handler_entry_t;
+static const key_handler_entry_t PROGMEM key_handler_list[] = {
+    { WN_CAPS, KH_CAPS_SONG },
+    { BL_TOGG, KH_BL_SONG },
+    { BL_DEC,  KH_BL_SONG },
+    { BL_INC,  KH_BL_SONG },
+    { BL_STEP, KH_BL_SONG },
+    { ADJUST,  KH_ADJUST_SONG },
+};
+#endif
+
+static bool process_key_handler(uint16_t keycode, keyrecord_t *record) {
+    uint8_t handler = KH_NONE;
+
+    if (keycode <= QK_BASIC_MAX) {     // 通常のキーはここで終わり
+        return true;
+    }
+    if (keycode >= SAFE_RANGE) {
+        if (keycode < PLANCK_KEYCODES_END) {
+            handler = pgm_read_byte(&key_handler_map[keycode - SAFE_RANGE]);
+        }
+    }
+    #ifdef AUDIO_ENABLE
+    else {
+        for (uint8_t i = 0; i < sizeof(key_handler_list) / sizeof(key_handler_list[0]); i++) {
+            if (pgm_read_word(&key_handler_list[i].keycode) == keycode) {
+                handler = pgm_read_byte(&key_handler_list[i].handler);
+                break;
+            }
+        }
+    }
+    #endif
+    if (handler == KH_NONE) {
+        return true;
+    }
+
+    #ifdef LATENCY_TRACE_ENABLE
+      uint16_t start = trace_clock();
+      bool ret = key_handlers[handler](keycode, record);
+      key_handler_stats[handler].calls++;
+      key_handler_stats[handler].time += (uint16_t)(trace_clock() - start);
+      return ret;
+    #else
+      return key_handlers[handler](keycode, record);
+    #endif
+}
+
+// 特殊キーが押された時の動作
+bool process_record_keymap(uint16_t keycode, keyrecord_t *record) {
+  if (record->event.pressed) {      // 押されたキー自身はこの後のtap_hold_pressで判定し直す
+    tap_hold_interrupt();
+    release_us_on_jis();
   }
-  return true;
-}
-
-// Macro actions for each corresponding ID.
-const macro_t *action_get_macro(keyrecord_t *record, uint8_t id, uint8_t opt)
-{
-    switch(id) {
-        case UM_EMHL: // タップで「英数」と「無変換」、ホールドで「Lower」
-        return MACRO_TAP_HOLD_LAYER( record, MACRO(T(MHEN), T(LANG2), END), _LOWER );
-        case UM_KHKR: // タップで「かな」と「変換」、ホールドで「Raise」
-        return MACRO_TAP_HOLD_LAYER( record, MACRO(T(HENK), T(LANG1), END), _RAISE );
-        case UM_KHRU: // タップで「かな」と「変換」、ホールドで「Raise(US配列用)」
-        return MACRO_TAP_HOLD_LAYER( record, MACRO(T(HENK), T(LANG1), END), _RAISE_US );
-        };
-        return MACRO_NONE;
+
+  if (!process_user_combo(record)) {
+    return false;
+  }
+
+  #ifdef MACRO_CANCEL_ON_KEYPRESS
+  if (macro_str != NULL && record->event.pressed) {   // マクロ送信中にキーを押したら中止
+    macro_stop();
+    return false;
+  }
+  #endif
+
+  #if defined(MOUSEKEY_ENABLE) && defined(MOUSEKEY_INERTIA)
+  if (!process_mouse_inertia(keycode, record)) {
+    return false;
+  }
+  #endif
+
+  if (biton32(default_layer_state) == _JIS && !process_us_on_jis(keycode, record)) {
+    return false;
+  }
+
+  return process_key_handler(keycode, record);
+}
+
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    idle_key_processed(record);
+    #ifdef KEYTRACE_ENABLE
+      keytrace_record(keycode, record);
+    #endif
+    #ifdef LATENCY_TRACE_ENABLE
+      uint16_t entry = timer_read();
+      uint16_t start = trace_clock();
+      bool ret = process_record_keymap(keycode, record);
+      trace_record(keycode, record, entry, trace_clock() - start);
+      return ret;
+    #else
+      return process_record_keymap(keycode, record);
+    #endif
 }
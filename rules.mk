@@ -3,6 +3,21 @@ MOUSEKEY_ENABLE  = yes
 
 CONSOLE_ENABLE = no         # Console for debug(+400)
 
+DEBOUNCE_TYPE = custom      # Per-key debounce, algorithm selected in config.h
+SRC += debounce_per_key.c
+
+LATENCY_TRACE_ENABLE = no   # Key processing latency trace, read out over raw HID
+ifeq ($(strip $(LATENCY_TRACE_ENABLE)), yes)
+    OPT_DEFS += -DLATENCY_TRACE_ENABLE
+    RAW_ENABLE = yes
+endif
+
+KEYTRACE_ENABLE = no        # Keystroke timing recorder (Rec on Adjust), read out over raw HID
+ifeq ($(strip $(KEYTRACE_ENABLE)), yes)
+    OPT_DEFS += -DKEYTRACE_ENABLE
+    RAW_ENABLE = yes
+endif
+
 ifndef QUANTUM_DIR
 	include ../../../../Makefile
 endif
@@ -0,0 +1,99 @@
+// debounce_per_key.cのテスト  チャタリングのあるキーの入力を1msごとのスキャンで再生し、反映された時刻を確かめる
+// ホストのコンパイラで両方のモードを試す（リポジトリの直下で実行）
+//   cc -I tests/stubs -o /tmp/debounce_test tests/debounce_per_key_test.c && /tmp/debounce_test
+//   cc -I tests/stubs -DDEBOUNCE_EAGER_PRESS -o /tmp/debounce_test tests/debounce_per_key_test.c && /tmp/debounce_test
+
+#include <stdio.h>
+#include "../debounce_per_key.c"
+
+uint32_t test_timer;
+
+#define TRACE_END 0xFF
+
+typedef struct {
+    uint8_t time;                    // 反映されたスキャンの時刻(ms)
+    bool    pressed;
+} edge_t;
+
+typedef struct {
+    const char *name;
+    const char *raw;                 // 1文字が1msのスキャン  '1'は押されている
+    edge_t      eager[4];            // DEBOUNCE_EAGER_PRESSの時の変化  TRACE_ENDで終わり
+    edge_t      deferred[4];         // 定義しない時の変化
+} trace_t;
+
+// DEBOUNCE 5ms
+static const trace_t traces[] = {
+    { "clean press and release",
+      "000111111111111111110000000000",
+      { {3, true},  {25, false}, {TRACE_END, false} },
+      { {8, true},  {25, false}, {TRACE_END, false} } },
+    { "bouncy press",
+      "00101101111111111111000000000",
+      { {2, true},  {25, false}, {TRACE_END, false} },
+      { {12, true}, {25, false}, {TRACE_END, false} } },
+    { "bouncy release",
+      "011111111111111111110100100000000",
+      { {1, true},  {30, false}, {TRACE_END, false} },
+      { {6, true},  {30, false}, {TRACE_END, false} } },
+    { "single-scan noise",
+      "000001000000000000",
+      { {5, true},  {11, false}, {TRACE_END, false} },
+      { {TRACE_END, false} } },
+};
+
+// 1つのキー（0行0列）で再生し、期待した変化と比べる  同じ行の他のキーは押したままにして影響がないことも見る
+static bool run_trace(const trace_t *t) {
+    #ifdef DEBOUNCE_EAGER_PRESS
+      const edge_t *expect = t->eager;
+    #else
+      const edge_t *expect = t->deferred;
+    #endif
+    matrix_row_t raw[MATRIX_ROWS] = { 0 };
+    matrix_row_t cooked[MATRIX_ROWS] = { 0 };
+    bool ok = true;
+
+    test_timer = 0;
+    debounce_init(MATRIX_ROWS);
+    raw[0] = cooked[0] = 1 << 5;
+    for (uint8_t i = 0; t->raw[i]; i++) {
+        test_timer = i;
+        matrix_row_t before = cooked[0] & 1;
+        matrix_row_t prev_raw = raw[0];
+        raw[0] = (raw[0] & ~1) | (t->raw[i] == '1');
+        debounce(raw, cooked, MATRIX_ROWS, raw[0] != prev_raw);   // マトリックスと同じく前のスキャンからの変化
+        if ((cooked[0] & 1) != before) {
+            bool pressed = cooked[0] & 1;
+            if (expect->time != i || expect->pressed != pressed) {
+                printf("  %s: unexpected %s at %u ms\n", t->name, pressed ? "press" : "release", i);
+                ok = false;
+            } else {
+                expect++;
+            }
+        }
+    }
+    if (expect->time != TRACE_END) {
+        printf("  %s: missing %s at %u ms\n", t->name, expect->pressed ? "press" : "release", expect->time);
+        ok = false;
+    }
+    if (!(cooked[0] & (1 << 5))) {
+        printf("  %s: held neighbour was released\n", t->name);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(void) {
+    uint8_t failed = 0;
+    #ifdef DEBOUNCE_EAGER_PRESS
+      printf("debounce_per_key (eager press, %u ms)\n", DEBOUNCE);
+    #else
+      printf("debounce_per_key (deferred, %u ms)\n", DEBOUNCE);
+    #endif
+    for (uint8_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        bool ok = run_trace(&traces[i]);
+        printf("%s %s\n", ok ? "ok  " : "FAIL", traces[i].name);
+        if (!ok) failed++;
+    }
+    return failed ? 1 : 0;
+}
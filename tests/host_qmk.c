@@ -0,0 +1,279 @@
+// ホストでのテスト用  keymap.cが呼ぶQMKの関数と、キー操作を再生する土台
+// QMKと違う点
+//   LT()とMT()はホールドだけ（タップしてもキーは送らない）  このキーマップのタップ/ホールドは自前なので困らない
+//   マウスキー、バックライト、EEPROMは記録するだけか何もしない
+
+#include "host_qmk.h"
+#include "eeprom.h"
+#include "raw_hid.h"
+
+uint32_t test_timer;
+keymap_config_t keymap_config;
+
+uint32_t layer_state;
+uint32_t default_layer_state;
+
+static report_keyboard_t host_report;
+report_keyboard_t *keyboard_report = &host_report;
+static uint8_t host_mods;
+
+host_report_t       host_reports[HOST_REPORTS_MAX];
+uint16_t            host_report_count;
+host_mouse_report_t host_mouse_reports[HOST_REPORTS_MAX];
+uint16_t            host_mouse_report_count;
+uint8_t             host_raw_packets[HOST_RAW_MAX][HOST_RAW_PACKET];
+uint8_t             host_raw_count;
+
+static matrix_row_t host_matrix[MATRIX_ROWS];
+static uint8_t      host_pressed_layer[MATRIX_ROWS][MATRIX_COLS];     // 押した時に決まったレイヤー（離す時もこのレイヤーで読む）
+static uint8_t      host_eeprom[1024];
+
+// send_charの変換表  quantum/keymap_extras/sendstring_*.hのUS配列と同じ
+const uint8_t ascii_to_keycode_lut[128] = {
+    0      , 0      , 0      , 0      , 0      , 0      , 0      , 0,
+    KC_BSPC, KC_TAB , KC_ENT , 0      , 0      , 0      , 0      , 0,
+    0      , 0      , 0      , 0      , 0      , 0      , 0      , 0,
+    0      , 0      , 0      , KC_ESC , 0      , 0      , 0      , 0,
+    KC_SPC , KC_1   , KC_QUOT, KC_3   , KC_4   , KC_5   , KC_7   , KC_QUOT,
+    KC_9   , KC_0   , KC_8   , KC_EQL , KC_COMM, KC_MINS, KC_DOT , KC_SLSH,
+    KC_0   , KC_1   , KC_2   , KC_3   , KC_4   , KC_5   , KC_6   , KC_7,
+    KC_8   , KC_9   , KC_SCLN, KC_SCLN, KC_COMM, KC_EQL , KC_DOT , KC_SLSH,
+    KC_2   , KC_A   , KC_B   , KC_C   , KC_D   , KC_E   , KC_F   , KC_G,
+    KC_H   , KC_I   , KC_J   , KC_K   , KC_L   , KC_M   , KC_N   , KC_O,
+    KC_P   , KC_Q   , KC_R   , KC_S   , KC_T   , KC_U   , KC_V   , KC_W,
+    KC_X   , KC_Y   , KC_Z   , KC_LBRC, KC_BSLS, KC_RBRC, KC_6   , KC_MINS,
+    KC_GRV , KC_A   , KC_B   , KC_C   , KC_D   , KC_E   , KC_F   , KC_G,
+    KC_H   , KC_I   , KC_J   , KC_K   , KC_L   , KC_M   , KC_N   , KC_O,
+    KC_P   , KC_Q   , KC_R   , KC_S   , KC_T   , KC_U   , KC_V   , KC_W,
+    KC_X   , KC_Y   , KC_Z   , KC_LBRC, KC_BSLS, KC_RBRC, KC_GRV , 0,
+};
+const uint8_t ascii_to_shift_lut[128] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 0,
+    1, 1, 1, 1, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 1, 0, 1, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 0, 0, 0, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 1, 1, 1, 1, 0,
+};
+
+// レポート操作
+void add_key(uint8_t key) {
+    for (uint8_t i = 0; i < sizeof(host_report.keys); i++) {
+        if (host_report.keys[i] == key) return;
+    }
+    for (uint8_t i = 0; i < sizeof(host_report.keys); i++) {
+        if (host_report.keys[i] == KC_NO) {
+            host_report.keys[i] = key;
+            return;
+        }
+    }
+}
+
+void del_key(uint8_t key) {
+    for (uint8_t i = 0; i < sizeof(host_report.keys); i++) {
+        if (host_report.keys[i] == key) host_report.keys[i] = KC_NO;
+    }
+}
+
+uint8_t get_mods(void) { return host_mods; }
+void set_mods(uint8_t mods) { host_mods = mods; }
+void add_mods(uint8_t mods) { host_mods |= mods; }
+void del_mods(uint8_t mods) { host_mods &= ~mods; }
+
+void send_keyboard_report(void) {
+    host_report.mods = host_mods;
+    if (host_report_count < HOST_REPORTS_MAX) {
+        host_reports[host_report_count].time = test_timer;
+        host_reports[host_report_count].report = host_report;
+        host_report_count++;
+    }
+}
+
+void register_code(uint8_t code) {
+    if (code >= KC_LCTL && code <= KC_RGUI) {
+        add_mods(MOD_BIT(code));
+    } else if (code != KC_NO && code < KC_MS_UP) {
+        add_key(code);
+    }
+    send_keyboard_report();
+}
+
+void unregister_code(uint8_t code) {
+    if (code >= KC_LCTL && code <= KC_RGUI) {
+        del_mods(MOD_BIT(code));
+    } else {
+        del_key(code);
+    }
+    send_keyboard_report();
+}
+
+void host_mouse_send(report_mouse_t *report) {
+    if (host_mouse_report_count < HOST_REPORTS_MAX) {
+        host_mouse_reports[host_mouse_report_count].time = test_timer;
+        host_mouse_reports[host_mouse_report_count].report = *report;
+        host_mouse_report_count++;
+    }
+}
+
+void raw_hid_send(uint8_t *data, uint8_t length) {
+    if (host_raw_count < HOST_RAW_MAX) {
+        memset(host_raw_packets[host_raw_count], 0, HOST_RAW_PACKET);
+        memcpy(host_raw_packets[host_raw_count], data, length < HOST_RAW_PACKET ? length : HOST_RAW_PACKET);
+        host_raw_count++;
+    }
+}
+
+void send_char(char ascii_code) {
+    uint8_t keycode = ascii_to_keycode_lut[(uint8_t)ascii_code];
+    bool shift = ascii_to_shift_lut[(uint8_t)ascii_code];
+    if (shift) register_code(KC_LSFT);
+    register_code(keycode);
+    unregister_code(keycode);
+    if (shift) unregister_code(KC_LSFT);
+}
+
+bool host_report_has_key(const report_keyboard_t *report, uint8_t key) {
+    for (uint8_t i = 0; i < sizeof(report->keys); i++) {
+        if (report->keys[i] == key) return true;
+    }
+    return false;
+}
+
+// レイヤー  action_layer.cと同じくlayer_state_set_userを通す
+static void host_layer_state_set(uint32_t state) {
+    layer_state = layer_state_set_user(state);
+}
+
+void layer_on(uint8_t layer) { host_layer_state_set(layer_state | (1UL << layer)); }
+void layer_off(uint8_t layer) { host_layer_state_set(layer_state & ~(1UL << layer)); }
+void default_layer_set(uint32_t state) { default_layer_state = default_layer_state_set_user(state); }
+
+__attribute__((weak)) uint32_t default_layer_state_set_user(uint32_t state) {
+    return state;
+}
+
+uint8_t biton32(uint32_t bits) {
+    uint8_t n = 0;
+    while (bits >>= 1) n++;
+    return n;
+}
+
+__attribute__((weak)) uint16_t keymap_key_to_keycode(uint8_t layer, keypos_t key) {
+    return keymaps[layer][key.row][key.col];
+}
+
+// 上のレイヤーから透過でないキーを探す（action_layer.cのlayer_switch_get_layer）
+static uint8_t host_layer_at(keypos_t key) {
+    uint32_t layers = layer_state | default_layer_state;
+    for (int8_t layer = 31; layer >= 0; layer--) {
+        if (!(layers & (1UL << layer))) continue;
+        if (keymap_key_to_keycode(layer, key) != KC_TRNS) return layer;
+    }
+    return 0;
+}
+
+// 修飾キーのビット（上位の0x10が右側）をmodsのビットにする
+static uint8_t host_mod_bits(uint8_t mods) {
+    return (mods & 0x10) ? (uint8_t)((mods & 0x0F) << 4) : (mods & 0x0F);
+}
+
+// process_record_userがtrueを返した時のQMKの処理
+static void host_default_action(uint16_t keycode, bool pressed) {
+    if (keycode <= QK_BASIC_MAX) {
+        if (pressed) register_code(keycode); else unregister_code(keycode);
+    } else if (keycode <= QK_MODS_MAX) {
+        uint8_t mods = host_mod_bits(keycode >> 8);
+        if (pressed) {
+            add_mods(mods);
+            register_code(keycode & 0xFF);
+        } else {
+            del_mods(mods);
+            unregister_code(keycode & 0xFF);
+        }
+    } else if (keycode >= QK_LAYER_TAP && keycode <= QK_LAYER_TAP_MAX) {
+        if (pressed) layer_on((keycode >> 8) & 0x0F); else layer_off((keycode >> 8) & 0x0F);
+    } else if (keycode >= QK_MOMENTARY && keycode <= QK_MOMENTARY_MAX) {
+        if (pressed) layer_on(keycode & 0xFF); else layer_off(keycode & 0xFF);
+    } else if (keycode >= QK_MOD_TAP && keycode <= QK_MOD_TAP_MAX) {
+        if (pressed) add_mods(host_mod_bits((keycode >> 8) & 0x1F)); else del_mods(host_mod_bits((keycode >> 8) & 0x1F));
+        send_keyboard_report();
+    }
+}
+
+// マトリックス、EEPROM、バックライト
+matrix_row_t matrix_get_row(uint8_t row) { return host_matrix[row]; }
+
+void eeprom_read_block(void *buf, const void *addr, size_t len) {
+    memcpy(buf, &host_eeprom[(uintptr_t)addr], len);
+}
+
+void eeprom_update_block(const void *buf, void *addr, size_t len) {
+    memcpy(&host_eeprom[(uintptr_t)addr], buf, len);
+}
+
+uint32_t eeconfig_read_user(void) { return 0; }
+uint32_t eeconfig_read_default_layer(void) { return 1; }
+
+void backlight_enable(void) {}
+void backlight_disable(void) {}
+void breathing_enable(void) {}
+void breathing_pulse(void) {}
+void breathing_self_disable(void) {}
+void breathing_period_set(uint8_t value) { (void)value; }
+
+// 再生
+void host_init(void) {
+    memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+    test_timer = 1000;
+    matrix_init_user();
+    host_scan(1);
+    host_clear_reports();
+}
+
+void host_clear_reports(void) {
+    host_report_count = 0;
+    host_mouse_report_count = 0;
+    host_raw_count = 0;
+}
+
+void host_scan(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        test_timer++;
+        matrix_scan_user();
+    }
+}
+
+// keyboard_taskと同じく、変化を読んだスキャンでmatrix_scan_userを呼んでからキーを処理する
+void host_key(uint8_t row, uint8_t col, bool pressed) {
+    if (pressed) {
+        host_matrix[row] |= (matrix_row_t)1 << col;
+    } else {
+        host_matrix[row] &= ~((matrix_row_t)1 << col);
+    }
+    host_scan(1);
+    keyrecord_t record = { .event = { .key = { .col = col, .row = row }, .pressed = pressed, .time = timer_read() } };
+    if (pressed) {
+        host_pressed_layer[row][col] = host_layer_at(record.event.key);
+    }
+    uint16_t keycode = keymap_key_to_keycode(host_pressed_layer[row][col], record.event.key);
+    if (process_record_user(keycode, &record)) {
+        host_default_action(keycode, pressed);
+    }
+}
+
+void host_replay(const host_event_t *events, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        host_scan(events[i].time);
+        host_key(events[i].row, events[i].col, events[i].pressed);
+    }
+}
@@ -0,0 +1,41 @@
+// ホストでのテスト用  keymap.cをQMKの代わりに動かす最小限の土台（tests/host_qmk.c）
+// キーの押下をprocess_record_userに渡し、QMKに任された基本のキーコードとレイヤーキーだけを処理する
+// 送られたキーボードとマウスのレポートは時刻付きで記録する
+#pragma once
+#include "quantum.h"
+
+#define HOST_REPORTS_MAX 512
+#define HOST_RAW_MAX     64
+#define HOST_RAW_PACKET  32
+
+typedef struct {
+    uint32_t          time;
+    report_keyboard_t report;
+} host_report_t;
+
+typedef struct {
+    uint32_t       time;
+    report_mouse_t report;
+} host_mouse_report_t;
+
+// 再生するキー操作  timeは前の操作からの時間(ms)  その間は1msごとにmatrix_scan_userを呼ぶ
+typedef struct {
+    uint16_t time;
+    uint8_t  row;
+    uint8_t  col;
+    bool     pressed;
+} host_event_t;
+
+extern host_report_t       host_reports[HOST_REPORTS_MAX];
+extern uint16_t            host_report_count;
+extern host_mouse_report_t host_mouse_reports[HOST_REPORTS_MAX];
+extern uint16_t            host_mouse_report_count;
+extern uint8_t             host_raw_packets[HOST_RAW_MAX][HOST_RAW_PACKET];   // raw_hid_sendで送ったもの
+extern uint8_t             host_raw_count;
+
+void host_init(void);                // EEPROMを消してmatrix_init_userを呼び、最初のスキャンをする
+void host_clear_reports(void);
+void host_scan(uint32_t ms);         // ms回（1msごと）matrix_scan_userを呼ぶ
+void host_key(uint8_t row, uint8_t col, bool pressed);   // 変化を読んだスキャン（matrix_scan_user）の後で処理する
+void host_replay(const host_event_t *events, uint8_t len);
+bool host_report_has_key(const report_keyboard_t *report, uint8_t key);
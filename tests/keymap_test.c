@@ -0,0 +1,367 @@
+// keymap.cのテスト  tests/host_qmk.cの上でキー操作を再生し、送られたレポートを確かめる
+// ホストのコンパイラで実行（リポジトリの直下で）
+//   cc -I tests/stubs -I tests/stubs/keyboards/planck -DMOUSEKEY_ENABLE -DBACKLIGHT_ENABLE -o /tmp/keymap_test tests/keymap_test.c tests/host_qmk.c && /tmp/keymap_test
+//   cc -I tests/stubs -I tests/stubs/keyboards/planck -DMOUSEKEY_ENABLE -DBACKLIGHT_ENABLE -DMACRO_ROLLING_REPORTS -o /tmp/keymap_test tests/keymap_test.c tests/host_qmk.c && /tmp/keymap_test
+//   SPARSE_KEYMAP、KEYCODE_CACHE、LATENCY_TRACE_ENABLEも -D で定義して試す
+
+#include <stdio.h>
+#include "../config.h"
+#include "../keymap.c"
+#include "host_qmk.h"
+
+#define EVENTS(e) e, sizeof(e) / sizeof(e[0])
+
+#define LOWER_POS 3, 4
+#define RAISE_POS 3, 7
+#define LSFT_POS  2, 0
+
+static const report_keyboard_t *last_report(void) {
+    static const report_keyboard_t empty;
+    return host_report_count ? &host_reports[host_report_count - 1].report : &empty;
+}
+
+// 記録したレポートの中にそのキーを押したものがあるか
+static bool any_report_has_key(uint8_t key) {
+    for (uint16_t i = 0; i < host_report_count; i++) {
+        if (host_report_has_key(&host_reports[i].report, key)) return true;
+    }
+    return false;
+}
+
+static bool all_released(const char *name) {
+    const report_keyboard_t *r = last_report();
+    for (uint8_t i = 0; i < sizeof(r->keys); i++) {
+        if (r->keys[i] != KC_NO || r->mods) {
+            printf("  %s: keys or mods left pressed\n", name);
+            return false;
+        }
+    }
+    if (layer_state) {
+        printf("  %s: layers left on (0x%lx)\n", name, (unsigned long)layer_state);
+        return false;
+    }
+    return true;
+}
+
+// Raiseの「=」（JISでは Shift + -）を押したままにすると、離すまでキーが押され続ける（キーリピート）
+static bool test_translated_key_repeats(void) {
+    static const host_event_t events[] = {
+        { 0,   RAISE_POS, true },
+        { 200, 1, 8, true },             // =
+    };
+    bool ok = true;
+    host_replay(EVENTS(events));
+    const report_keyboard_t *r = last_report();
+    if (!host_report_has_key(r, KC_MINS) || r->mods != MOD_BIT(KC_LSFT)) {
+        printf("  = was not sent as Shift + -\n");
+        ok = false;
+    }
+    host_scan(600);
+    if (!host_report_has_key(last_report(), KC_MINS)) {
+        printf("  = was released while held\n");
+        ok = false;
+    }
+    host_key(1, 8, false);
+    host_key(RAISE_POS, false);
+    if (any_report_has_key(KC_LANG1) || any_report_has_key(KC_HENK)) {
+        printf("  Raise held over a key sent an IME key\n");
+        ok = false;
+    }
+    return all_released("repeat") && ok;
+}
+
+// 変換して押しているキーの置き換えたmodsが、次に押したキーに付かない
+static bool test_translated_mods_do_not_leak(void) {
+    bool ok = true;
+    host_key(RAISE_POS, true);
+    host_scan(200);
+    host_key(1, 8, true);                // =  Shift + -
+    host_scan(50);
+    host_key(1, 7, true);                // -  Shiftなし
+    const report_keyboard_t *r = last_report();
+    if (!host_report_has_key(r, KC_MINS) || r->mods != 0) {
+        printf("  - after = was sent with mods 0x%02x\n", r->mods);
+        ok = false;
+    }
+    host_key(1, 7, false);
+    host_key(1, 8, false);
+    host_key(RAISE_POS, false);
+
+    host_key(LSFT_POS, true);
+    host_key(1, 10, true);               // Shift + ;  は : （Shiftを外す）
+    r = last_report();
+    if (!host_report_has_key(r, KC_QUOT) || r->mods != 0) {
+        printf("  : was sent with mods 0x%02x\n", r->mods);
+        ok = false;
+    }
+    host_key(1, 1, true);                // Shiftを押したままのA
+    r = last_report();
+    if (!host_report_has_key(r, KC_A) || r->mods != MOD_BIT(KC_LSFT)) {
+        printf("  A after : was sent with mods 0x%02x\n", r->mods);
+        ok = false;
+    }
+    host_key(1, 1, false);
+    host_key(1, 10, false);
+    host_key(LSFT_POS, false);
+    return all_released("mods") && ok;
+}
+
+// Lowerをタップすると「英数」「無変換」、長押しでは送らない
+static bool test_lower_tap_and_hold(void) {
+    static const host_event_t tap[] = {
+        { 0,  LOWER_POS, true },
+        { 50, LOWER_POS, false },
+    };
+    static const host_event_t hold[] = {
+        { 0,   LOWER_POS, true },
+        { 300, LOWER_POS, false },
+    };
+    bool ok = true;
+    host_replay(EVENTS(tap));
+    if (!any_report_has_key(KC_LANG2) || !any_report_has_key(KC_MHEN)) {
+        printf("  tap did not send the IME off keys\n");
+        ok = false;
+    }
+    host_clear_reports();
+    host_replay(EVENTS(hold));
+    if (host_report_count) {
+        printf("  hold sent %u reports\n", host_report_count);
+        ok = false;
+    }
+    return all_released("lower") && ok;
+}
+
+// SFT_JQTのタップはJISの「'」（Shift + 7）、Shiftを押しながらなら「"」（Shift + 2）
+static bool test_sft_jqt_tap(void) {
+    static const host_event_t quote[] = {
+        { 0,  2, 11, true },
+        { 50, 2, 11, false },
+    };
+    static const host_event_t dquote[] = {
+        { 0,  LSFT_POS, true },
+        { 20, 2, 11, true },
+        { 50, 2, 11, false },
+        { 20, LSFT_POS, false },
+    };
+    bool ok = true;
+    host_replay(EVENTS(quote));
+    if (!any_report_has_key(KC_7)) {
+        printf("  ' was not sent\n");
+        ok = false;
+    }
+    for (uint16_t i = 0; i < host_report_count; i++) {
+        if (host_report_has_key(&host_reports[i].report, KC_7) && host_reports[i].report.mods != MOD_BIT(KC_LSFT)) {
+            printf("  ' was sent with mods 0x%02x\n", host_reports[i].report.mods);
+            ok = false;
+        }
+    }
+    host_clear_reports();
+    host_replay(EVENTS(dquote));
+    if (!any_report_has_key(KC_2) || any_report_has_key(KC_7)) {
+        printf("  Shift + SFT_JQT did not send \"\n");
+        ok = false;
+    }
+    return all_released("sft_jqt") && ok;
+}
+
+// Lower + RaiseはCOMBO_TERM以内ならAdjust、遅ければLowerの0
+static bool test_lower_raise_combo(void) {
+    static const host_event_t combo[] = {
+        { 0,  LOWER_POS, true },
+        { 20, RAISE_POS, true },
+    };
+    static const host_event_t late[] = {
+        { 0,   LOWER_POS, true },
+        { 100, RAISE_POS, true },
+    };
+    bool ok = true;
+    host_replay(EVENTS(combo));
+    if (!IS_LAYER_ON(_ADJUST)) {
+        printf("  Lower + Raise did not turn Adjust on\n");
+        ok = false;
+    }
+    host_key(RAISE_POS, false);
+    host_key(LOWER_POS, false);
+    if (host_report_count) {
+        printf("  Lower + Raise sent %u reports\n", host_report_count);
+        ok = false;
+    }
+    host_replay(EVENTS(late));
+    if (IS_LAYER_ON(_ADJUST) || !host_report_has_key(last_report(), KC_0)) {
+        printf("  Lower then Raise after %u ms did not type 0\n", COMBO_TERM);
+        ok = false;
+    }
+    host_key(RAISE_POS, false);
+    host_key(LOWER_POS, false);
+    return all_released("combo") && ok;
+}
+
+// マクロはメインループで1文字ずつ送られ、レポートの順に読むと元の文字列になる
+static bool test_macro_string(void) {
+    static const host_event_t events[] = {
+        { 0,  0, 0, true },              // Function_2
+        { 20, 0, 6, true },              // MACRO_1
+        { 10, 0, 6, false },
+        { 10, 0, 0, false },
+    };
+    char typed[32];
+    uint8_t len = 0;
+    bool ok = true;
+    host_replay(EVENTS(events));
+    host_scan(1000);
+
+    static const report_keyboard_t empty;
+    const report_keyboard_t *prev = &empty;
+    for (uint16_t i = 0; i < host_report_count; i++) {
+        const report_keyboard_t *r = &host_reports[i].report;
+        for (uint8_t k = 0; k < sizeof(r->keys); k++) {
+            if (r->keys[k] == KC_NO || host_report_has_key(prev, r->keys[k])) continue;
+            bool shift = r->mods & SHIFT_MODS;
+            for (uint8_t c = 0; c < 128; c++) {
+                if (ascii_to_keycode_lut[c] == r->keys[k] && ascii_to_shift_lut[c] == shift) {
+                    if (len < sizeof(typed) - 1) typed[len++] = c;
+                    break;
+                }
+            }
+        }
+        prev = r;
+    }
+    typed[len] = '\0';
+    if (strcmp(typed, "This is a test.") != 0) {
+        printf("  typed \"%s\"\n", typed);
+        ok = false;
+    }
+    return all_released("macro") && ok;
+}
+
+// 押している間にレイヤーが変わっても、押した時のキーが離される
+static bool test_release_after_layer_change(void) {
+    static const host_event_t events[] = {
+        { 0,   LOWER_POS, true },
+        { 200, 3, 5, true },             // Lowerでは透過のSpace
+        { 10,  0, 1, true },             // Lowerの1
+        { 10,  LOWER_POS, false },
+        { 10,  3, 5, false },
+        { 10,  0, 1, false },
+    };
+    bool ok = true;
+    host_replay(EVENTS(events));
+    if (!any_report_has_key(KC_SPC) || !any_report_has_key(KC_1)) {
+        printf("  Space and 1 were not sent on Lower\n");
+        ok = false;
+    }
+    return all_released("layer change") && ok;
+}
+
+#ifdef KEYCODE_CACHE
+// キャッシュした一番上のレイヤーのキーコードが、上のレイヤーから透過でないキーを探した結果と同じ
+static bool test_keycode_cache(void) {
+    static const uint8_t layers[] = { _LOWER, _RAISE, _FUNC1, _FUNC2, _ADJUST };
+    bool ok = true;
+    for (uint8_t base = _JIS; base <= _US; base++) {
+        default_layer_set(1UL << base);
+        for (uint8_t combo = 0; combo < (1 << sizeof(layers)); combo++) {
+            for (uint8_t i = 0; i < sizeof(layers); i++) {
+                if (combo & (1 << i)) layer_on(layers[i]); else layer_off(layers[i]);
+            }
+            uint32_t state = layer_state | default_layer_state;
+            for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+                for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+                    keypos_t key = { .col = col, .row = row };
+                    uint16_t expect = KC_TRNS;
+                    for (int8_t layer = 31; layer >= 0 && expect == KC_TRNS; layer--) {
+                        if (state & (1UL << layer)) expect = keymap_layer_keycode(layer, key);
+                    }
+                    uint16_t cached = keymap_key_to_keycode(biton32(state), key);
+                    if (cached != expect) {
+                        printf("  layers 0x%02lx (%u, %u): cached 0x%04x, expected 0x%04x\n",
+                               (unsigned long)state, row, col, cached, expect);
+                        ok = false;
+                    }
+                }
+            }
+        }
+    }
+    for (uint8_t i = 0; i < sizeof(layers); i++) {
+        layer_off(layers[i]);
+    }
+    default_layer_set(1UL << _JIS);
+    return ok;
+}
+#endif
+
+#ifdef LATENCY_TRACE_ENABLE
+// 省電力のスキャンから復帰した最初のキーの遅れは、最後にidle_sleep_msに入った時からそのキーの処理まで
+// Raw HIDの'L'で読み出すと'I'のパケットに入っている
+static bool test_wake_latency(void) {
+    bool ok = true;
+    host_scan(IDLE_SLOW_SCAN_TIME + 1000);
+    uint32_t sleep_entry = test_timer;   // 最後のスキャンでidle_sleep_msに入った
+    host_key(1, 1, true);
+    uint16_t expect = test_timer - sleep_entry;
+    host_key(1, 1, false);
+    host_scan(20);
+    host_key(1, 2, true);                // 復帰の後のキーは数えない
+    host_key(1, 2, false);
+
+    uint8_t request[TRACE_PACKET] = { 'L' };
+    trace_wake_stat_t stat = { 0 };
+    raw_hid_receive(request, sizeof(request));
+    for (uint8_t i = 0; i < host_raw_count; i++) {
+        if (host_raw_packets[i][0] == 'I') memcpy(&stat, &host_raw_packets[i][2], sizeof(stat));
+    }
+    if (stat.wakes != 1 || stat.last != expect || stat.max != expect) {
+        printf("  wakes %u, last %u ms, max %u ms (expected 1 wake, %u ms)\n", stat.wakes, stat.last, stat.max, expect);
+        ok = false;
+    }
+    return all_released("wake") && ok;
+}
+#endif
+
+typedef struct {
+    const char *name;
+    bool (*run)(void);
+} test_t;
+
+static const test_t tests[] = {
+    { "translated key repeats while held", test_translated_key_repeats },
+    { "translated mods do not leak",       test_translated_mods_do_not_leak },
+    { "lower tap and hold",                test_lower_tap_and_hold },
+    { "sft_jqt tap",                       test_sft_jqt_tap },
+    { "lower + raise combo",               test_lower_raise_combo },
+    { "macro string",                      test_macro_string },
+    { "release after layer change",        test_release_after_layer_change },
+#ifdef KEYCODE_CACHE
+    { "keycode cache",                     test_keycode_cache },
+#endif
+#ifdef LATENCY_TRACE_ENABLE
+    { "wake latency",                      test_wake_latency },
+#endif
+};
+
+int main(void) {
+    uint8_t failed = 0;
+    printf("keymap");
+    #ifdef MACRO_ROLLING_REPORTS
+      printf(" (rolling macro reports)");
+    #endif
+    #ifdef SPARSE_KEYMAP
+      printf(" (sparse keymap)");
+    #endif
+    #ifdef KEYCODE_CACHE
+      printf(" (keycode cache)");
+    #endif
+    #ifdef LATENCY_TRACE_ENABLE
+      printf(" (latency trace)");
+    #endif
+    printf("\n");
+    host_init();
+    for (uint8_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        host_clear_reports();
+        bool ok = tests[i].run();
+        printf("%s %s\n", ok ? "ok  " : "FAIL", tests[i].name);
+        if (!ok) failed++;
+        host_scan(500);                  // 次のテストまでにタップの判定などを終わらせておく
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+// マウスキーの慣性（mk_axis_step）のテスト  tests/host_qmk.cの上でマウスキーを押し、送られたマウスのレポートを確かめる
+// ホストのコンパイラで実行（リポジトリの直下で）
+//   cc -I tests/stubs -I tests/stubs/keyboards/planck -DMOUSEKEY_ENABLE -o /tmp/mk_axis_step_test tests/mk_axis_step_test.c tests/host_qmk.c && /tmp/mk_axis_step_test
+
+#include <stdio.h>
+#include "../config.h"
+#include "../keymap.c"
+#include "host_qmk.h"
+
+#define FN1_POS   1, 0
+#define MS_R_POS  1, 4               // Function_1のKC_MS_R
+#define WH_D_POS  0, 3               // Function_1のKC_WH_D
+
+#define TICKS_PER_SEC (1000 / MK_INERTIA_INTERVAL)
+
+typedef struct {
+    int32_t  x;
+    int32_t  v;
+    uint16_t reports;
+    uint32_t first;                  // 最初のレポートの時刻
+    uint32_t last;                   // 最後のレポートの時刻
+} motion_t;
+
+static motion_t motion_since(uint16_t from) {
+    motion_t m = { 0 };
+    for (uint16_t i = from; i < host_mouse_report_count; i++) {
+        const host_mouse_report_t *r = &host_mouse_reports[i];
+        if (!r->report.x && !r->report.v) continue;
+        m.x += r->report.x;
+        m.v += r->report.v;
+        if (!m.reports) m.first = r->time;
+        m.last = r->time;
+        m.reports++;
+    }
+    return m;
+}
+
+// Function_1でキーをms押して離し（押した処理から離した処理まで）、止まるまで待つ
+static motion_t press_for(uint8_t row, uint8_t col, uint16_t ms, uint32_t *pressed_at) {
+    host_clear_reports();
+    host_key(FN1_POS, true);
+    host_scan(20);
+    host_key(row, col, true);
+    *pressed_at = test_timer;
+    host_scan(ms - 1);               // 離した変化を読むスキャンで1ms進む
+    host_key(row, col, false);
+    host_scan(500);
+    host_key(FN1_POS, false);
+    return motion_since(0);
+}
+
+// mk_axis_stepだけで計算した移動量  減速して止まる時に四捨五入する
+static int32_t expected_distance(uint16_t ticks, int16_t accel, int16_t max) {
+    int32_t total = 256;             // 押した最初の1回の1単位
+    int16_t velocity = 0;
+    for (uint16_t i = 0; i < ticks; i++) {
+        velocity = (velocity + accel > max) ? max : velocity + accel;
+        total += velocity;
+    }
+    while (velocity >= 16) {
+        velocity -= velocity / 4;
+        if (velocity >= 16) total += velocity;
+    }
+    return (total + 128) / 256;
+}
+
+// 1回の移動の間隔より短いタップでも1ピクセル動く
+static bool test_cursor_tap(void) {
+    uint32_t at;
+    motion_t m = press_for(MS_R_POS, MK_INERTIA_INTERVAL, &at);
+    if (m.x != 1) {
+        printf("  %u ms tap moved %ld px\n", MK_INERTIA_INTERVAL, (long)m.x);
+        return false;
+    }
+    if (m.first - at > 1) {
+        printf("  first move %lu ms after the press\n", (unsigned long)(m.first - at));
+        return false;
+    }
+    return true;
+}
+
+// ホイールの短いタップで1目盛り動く
+static bool test_wheel_tap(void) {
+    uint32_t at;
+    motion_t m = press_for(WH_D_POS, MK_INERTIA_INTERVAL, &at);
+    if (m.v != -1) {
+        printf("  %u ms wheel tap scrolled %ld notches\n", MK_INERTIA_INTERVAL, (long)m.v);
+        return false;
+    }
+    return true;
+}
+
+// 1秒押し続けた時の移動量は端数を落とさずに計算したものと1ピクセルも違わない
+// レポートは移動の間隔ごとに1つまで
+static bool test_cursor_hold(void) {
+    uint32_t at;
+    bool ok = true;
+    motion_t m = press_for(MS_R_POS, 1000, &at);
+    int32_t expect = expected_distance(1000 / MK_INERTIA_INTERVAL, MK_INERTIA_ACCEL, MK_INERTIA_MAX);
+    if (m.x != expect) {
+        printf("  1 s hold moved %ld px, expected %ld\n", (long)m.x, (long)expect);
+        ok = false;
+    }
+    if (m.reports > TICKS_PER_SEC + 10) {
+        printf("  %u reports in about 1 s (interval %u ms)\n", m.reports, MK_INERTIA_INTERVAL);
+        ok = false;
+    }
+    if (m.last - at > 1000 + 200) {
+        printf("  kept moving %lu ms after the release\n", (unsigned long)(m.last - at - 1000));
+        ok = false;
+    }
+    printf("       cursor: %ld px, %u reports in 1 s hold\n", (long)m.x, m.reports);
+    return ok;
+}
+
+// ホイールは押してすぐに動き、1秒で最大速度に近い目盛り数になる
+static bool test_wheel_hold(void) {
+    uint32_t at;
+    bool ok = true;
+    motion_t m = press_for(WH_D_POS, 1000, &at);
+    int32_t expect = expected_distance(1000 / MK_INERTIA_INTERVAL, MK_INERTIA_WHEEL_ACCEL, MK_INERTIA_WHEEL_MAX);
+    if (-m.v != expect) {
+        printf("  1 s wheel hold scrolled %ld notches, expected %ld\n", (long)-m.v, (long)expect);
+        ok = false;
+    }
+    if (m.first - at > 1) {
+        printf("  first notch %lu ms after the press\n", (unsigned long)(m.first - at));
+        ok = false;
+    }
+    if (-m.v < (int32_t)MK_INERTIA_WHEEL_MAX * TICKS_PER_SEC / 256 * 3 / 4) {
+        printf("  wheel too slow: %ld notches/s\n", (long)-m.v);
+        ok = false;
+    }
+    printf("       wheel: %ld notches, %u reports in 1 s hold\n", (long)-m.v, m.reports);
+    return ok;
+}
+
+// 逆向きに押すとすぐに止まって逆に動き始める
+static bool test_reverse(void) {
+    mk_axis_t axis = { 0 };
+    for (uint8_t i = 0; i < 20; i++) {
+        mk_axis_step(&axis, 1, MK_INERTIA_ACCEL, MK_INERTIA_MAX);
+    }
+    int8_t delta = mk_axis_step(&axis, -1, MK_INERTIA_ACCEL, MK_INERTIA_MAX);
+    if (delta != -1 || axis.velocity != -MK_INERTIA_ACCEL) {
+        printf("  reverse moved %d (velocity %d)\n", delta, axis.velocity);
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    bool (*run)(void);
+} test_t;
+
+static const test_t tests[] = {
+    { "cursor tap",  test_cursor_tap },
+    { "wheel tap",   test_wheel_tap },
+    { "cursor hold", test_cursor_hold },
+    { "wheel hold",  test_wheel_hold },
+    { "reverse",     test_reverse },
+};
+
+int main(void) {
+    uint8_t failed = 0;
+    printf("mk_axis_step (interval %u ms)\n", MK_INERTIA_INTERVAL);
+    host_init();
+    for (uint8_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        bool ok = tests[i].run();
+        printf("%s %s\n", ok ? "ok  " : "FAIL", tests[i].name);
+        if (!ok) failed++;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+// ホストでのテスト用  レイヤーの宣言はquantum.hにある
+#pragma once
+#include "quantum.h"
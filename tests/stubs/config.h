@@ -0,0 +1,3 @@
+// ホストでのテスト用  keyboards/planck/config.hの代わり
+// キーマップのconfig.hの "../../config.h" は -I tests/stubs/keyboards/planck から見てここになる
+#pragma once
@@ -0,0 +1,7 @@
+// ホストでのテスト用  quantum/debounce.hと同じ宣言
+#pragma once
+#include "matrix.h"
+
+void debounce_init(uint8_t num_rows);
+void debounce(matrix_row_t raw[], matrix_row_t cooked[], uint8_t num_rows, bool changed);
+bool debounce_active(void);
@@ -0,0 +1,6 @@
+// ホストでのテスト用  avr/eeprom.hと同じ宣言  中身はtests/host_qmk.cのRAM
+#pragma once
+#include <stddef.h>
+
+void eeprom_read_block(void *buf, const void *addr, size_t len);
+void eeprom_update_block(const void *buf, void *addr, size_t len);
@@ -0,0 +1,3 @@
+// ホストでのテスト用  keyboards/planck/planck.hの代わり
+#pragma once
+#include "quantum.h"
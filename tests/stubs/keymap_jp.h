@@ -0,0 +1,25 @@
+// ホストでのテスト用  quantum/keymap_extras/keymap_jp.hのうちkeymap.cが使うもの
+#pragma once
+#include "quantum.h"
+
+#define JP_AT   KC_LBRC
+#define JP_CIRC KC_EQL
+#define JP_AMPR LSFT(KC_6)
+#define JP_ASTR LSFT(KC_QUOT)
+#define JP_LPRN LSFT(KC_8)
+#define JP_RPRN LSFT(KC_9)
+#define JP_UNDS LSFT(KC_RO)
+#define JP_EQL  LSFT(KC_MINS)
+#define JP_PLUS LSFT(KC_SCLN)
+#define JP_LBRC KC_RBRC
+#define JP_LCBR LSFT(KC_RBRC)
+#define JP_RBRC KC_BSLS
+#define JP_RCBR LSFT(KC_BSLS)
+#define JP_YEN  KC_JYEN
+#define JP_PIPE LSFT(KC_JYEN)
+#define JP_SCLN KC_SCLN
+#define JP_COLN KC_QUOT
+#define JP_QUOT LSFT(KC_7)
+#define JP_DQT  LSFT(KC_2)
+#define JP_GRV  LSFT(KC_LBRC)
+#define JP_TILD LSFT(KC_EQL)
@@ -0,0 +1,8 @@
+// ホストでのテスト用  Planck（4行 x 12列）のマトリックス
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MATRIX_ROWS 4
+#define MATRIX_COLS 12
+typedef uint16_t matrix_row_t;
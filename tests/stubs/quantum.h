@@ -0,0 +1,210 @@
+// ホストでのテスト用  keymap.cが使うQMKの宣言だけを集めたもの
+// キーコードの値はtmk_core/common/keycode.hとquantum/quantum_keycodes.hに合わせる
+// 関数の中身はtests/host_qmk.c
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "matrix.h"
+#include "timer.h"
+
+// AVRのプログラムメモリはホストでは普通のメモリ
+#define PROGMEM
+#define PSTR(s)              (s)
+#define pgm_read_byte(p)     (*(const uint8_t *)(p))
+#define pgm_read_word(p)     (*(const uint16_t *)(p))
+#define pgm_read_dword(p)    (*(const uint32_t *)(p))
+#define memcpy_P             memcpy
+#define dprintf(...)         ((void)0)
+
+// 基本のキーコード（HID Usage ID）
+enum hid_keyboard_keycodes {
+  KC_NO = 0x00, KC_TRNS,
+  KC_A = 0x04, KC_B, KC_C, KC_D, KC_E, KC_F, KC_G, KC_H, KC_I, KC_J, KC_K, KC_L, KC_M,
+  KC_N, KC_O, KC_P, KC_Q, KC_R, KC_S, KC_T, KC_U, KC_V, KC_W, KC_X, KC_Y, KC_Z,
+  KC_1, KC_2, KC_3, KC_4, KC_5, KC_6, KC_7, KC_8, KC_9, KC_0,
+  KC_ENT, KC_ESC, KC_BSPC, KC_TAB, KC_SPC, KC_MINS, KC_EQL, KC_LBRC, KC_RBRC, KC_BSLS,
+  KC_NUHS, KC_SCLN, KC_QUOT, KC_GRV, KC_COMM, KC_DOT, KC_SLSH, KC_CAPS,
+  KC_F1, KC_F2, KC_F3, KC_F4, KC_F5, KC_F6, KC_F7, KC_F8, KC_F9, KC_F10, KC_F11, KC_F12,
+  KC_PSCR, KC_SLCK, KC_PAUS, KC_INS, KC_HOME, KC_PGUP, KC_DEL, KC_END, KC_PGDN,
+  KC_RGHT, KC_LEFT, KC_DOWN, KC_UP, KC_NLCK, KC_PSLS, KC_PAST, KC_PMNS, KC_PPLS, KC_PENT,
+  KC_P1, KC_P2, KC_P3, KC_P4, KC_P5, KC_P6, KC_P7, KC_P8, KC_P9, KC_P0, KC_PDOT,
+  KC_NUBS, KC_APP, KC_POWER, KC_PEQL,
+  KC_INT1 = 0x87, KC_INT2, KC_INT3, KC_INT4, KC_INT5, KC_INT6, KC_INT7, KC_INT8, KC_INT9,
+  KC_LANG1, KC_LANG2,
+  KC_MUTE = 0xA8, KC_VOLU, KC_VOLD, KC_MNXT, KC_MPRV, KC_MFFD, KC_MRWD, KC_MSTP, KC_MPLY,
+  KC_LCTL = 0xE0, KC_LSFT, KC_LALT, KC_LGUI, KC_RCTL, KC_RSFT, KC_RALT, KC_RGUI,
+  KC_MS_UP = 0xF0, KC_MS_DOWN, KC_MS_LEFT, KC_MS_RIGHT,
+  KC_MS_BTN1, KC_MS_BTN2, KC_MS_BTN3, KC_MS_BTN4, KC_MS_BTN5,
+  KC_MS_WH_UP, KC_MS_WH_DOWN, KC_MS_WH_LEFT, KC_MS_WH_RIGHT,
+  KC_MS_ACCEL0, KC_MS_ACCEL1, KC_MS_ACCEL2
+};
+#define KC_RO     KC_INT1
+#define KC_KANA   KC_INT2
+#define KC_JYEN   KC_INT3
+#define KC_HENK   KC_INT4
+#define KC_MHEN   KC_INT5
+#define KC_ZKHK   KC_GRV
+#define KC_MS_U   KC_MS_UP
+#define KC_MS_D   KC_MS_DOWN
+#define KC_MS_L   KC_MS_LEFT
+#define KC_MS_R   KC_MS_RIGHT
+#define KC_BTN1   KC_MS_BTN1
+#define KC_BTN2   KC_MS_BTN2
+#define KC_BTN3   KC_MS_BTN3
+#define KC_WH_U   KC_MS_WH_UP
+#define KC_WH_D   KC_MS_WH_DOWN
+#define KC_WH_L   KC_MS_WH_LEFT
+#define KC_WH_R   KC_MS_WH_RIGHT
+#define KC_ACL0   KC_MS_ACCEL0
+#define KC_ACL1   KC_MS_ACCEL1
+#define KC_ACL2   KC_MS_ACCEL2
+#define XXXXXXX   KC_NO
+#define _______   KC_TRNS
+
+// 修飾キー付き、レイヤー、Mod-Tapなど
+#define QK_BASIC_MAX     0x00FF
+#define QK_MODS          0x0100
+#define QK_LCTL          0x0100
+#define QK_LSFT          0x0200
+#define QK_LALT          0x0400
+#define QK_LGUI          0x0800
+#define QK_RMODS_MIN     0x1000
+#define QK_MODS_MAX      0x1FFF
+#define QK_LAYER_TAP     0x4000
+#define QK_LAYER_TAP_MAX 0x4FFF
+#define QK_MOMENTARY     0x5100
+#define QK_MOMENTARY_MAX 0x51FF
+#define QK_MOD_TAP       0x6000
+#define QK_MOD_TAP_MAX   0x7FFF
+
+#define LCTL(kc)         (QK_LCTL | (kc))
+#define LSFT(kc)         (QK_LSFT | (kc))
+#define LALT(kc)         (QK_LALT | (kc))
+#define LGUI(kc)         (QK_LGUI | (kc))
+#define LCA(kc)          (QK_LCTL | QK_LALT | (kc))
+#define S(kc)            LSFT(kc)
+#define LT(layer, kc)    (QK_LAYER_TAP | (((layer) & 0xF) << 8) | ((kc) & 0xFF))
+#define MO(layer)        (QK_MOMENTARY | ((layer) & 0xFF))
+#define MT(mod, kc)      (QK_MOD_TAP | (((mod) & 0x1F) << 8) | ((kc) & 0xFF))
+#define CTL_T(kc)        MT(MOD_LCTL, kc)
+#define GUI_T(kc)        MT(MOD_LGUI, kc)
+
+enum mods_bit {
+  MOD_LCTL = 0x01, MOD_LSFT = 0x02, MOD_LALT = 0x04, MOD_LGUI = 0x08,
+  MOD_RCTL = 0x11, MOD_RSFT = 0x12, MOD_RALT = 0x14, MOD_RGUI = 0x18
+};
+#define MOD_BIT(code)    (1 << ((code) & 0x07))
+
+#define KC_EXLM LSFT(KC_1)
+#define KC_AT   LSFT(KC_2)
+#define KC_HASH LSFT(KC_3)
+#define KC_DLR  LSFT(KC_4)
+#define KC_PERC LSFT(KC_5)
+#define KC_CIRC LSFT(KC_6)
+#define KC_AMPR LSFT(KC_7)
+#define KC_ASTR LSFT(KC_8)
+#define KC_LPRN LSFT(KC_9)
+#define KC_RPRN LSFT(KC_0)
+#define KC_UNDS LSFT(KC_MINS)
+#define KC_PLUS LSFT(KC_EQL)
+#define KC_LCBR LSFT(KC_LBRC)
+#define KC_RCBR LSFT(KC_RBRC)
+#define KC_PIPE LSFT(KC_BSLS)
+#define KC_COLN LSFT(KC_SCLN)
+#define KC_DQUO LSFT(KC_QUOT)
+#define KC_TILD LSFT(KC_GRV)
+
+// quantumのキーコード  テストでは押しても何もしない
+enum quantum_keycodes {
+  RESET = 0x5C00,
+  AU_ON, AU_OFF, AU_TOG,
+  MU_ON, MU_OFF, MU_TOG, MU_MOD,
+  MUV_IN, MUV_DE,
+  BL_ON, BL_OFF, BL_DEC, BL_INC, BL_TOGG, BL_STEP, BL_BRTG,
+  SAFE_RANGE = 0x5D00
+};
+
+// キーイベント
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+typedef struct {
+    keypos_t key;
+    bool     pressed;
+    uint16_t time;
+} keyevent_t;
+typedef struct {
+    keyevent_t event;
+} keyrecord_t;
+
+// レポート
+typedef struct {
+    uint8_t mods;
+    uint8_t reserved;
+    uint8_t keys[6];
+} report_keyboard_t;
+typedef struct {
+    uint8_t buttons;
+    int8_t  x;
+    int8_t  y;
+    int8_t  v;
+    int8_t  h;
+} report_mouse_t;
+extern report_keyboard_t *keyboard_report;
+
+typedef union {
+    uint16_t raw;
+} keymap_config_t;
+
+#define USB_LED_NUM_LOCK  0
+#define USB_LED_CAPS_LOCK 1
+
+// キーマップ
+extern const uint16_t keymaps[][MATRIX_ROWS][MATRIX_COLS];
+uint16_t keymap_key_to_keycode(uint8_t layer, keypos_t key);
+
+// レポート操作
+void add_key(uint8_t key);
+void del_key(uint8_t key);
+uint8_t get_mods(void);
+void set_mods(uint8_t mods);
+void add_mods(uint8_t mods);
+void del_mods(uint8_t mods);
+void send_keyboard_report(void);
+void register_code(uint8_t code);
+void unregister_code(uint8_t code);
+void host_mouse_send(report_mouse_t *report);
+void send_char(char ascii_code);
+extern const uint8_t ascii_to_keycode_lut[128];
+extern const uint8_t ascii_to_shift_lut[128];
+
+// レイヤー
+extern uint32_t layer_state;
+extern uint32_t default_layer_state;
+void layer_on(uint8_t layer);
+void layer_off(uint8_t layer);
+void default_layer_set(uint32_t state);
+uint8_t biton32(uint32_t bits);
+#define IS_LAYER_ON(layer) ((layer_state & (1UL << (layer))) != 0)
+
+// マトリックス、EEPROM、バックライト
+matrix_row_t matrix_get_row(uint8_t row);
+uint32_t eeconfig_read_user(void);
+uint32_t eeconfig_read_default_layer(void);
+void backlight_enable(void);
+void backlight_disable(void);
+void breathing_enable(void);
+void breathing_pulse(void);
+void breathing_self_disable(void);
+void breathing_period_set(uint8_t value);
+
+// keymap.cが定義するもの
+bool process_record_user(uint16_t keycode, keyrecord_t *record);
+void matrix_init_user(void);
+void matrix_scan_user(void);
+uint32_t layer_state_set_user(uint32_t state);
+uint32_t default_layer_state_set_user(uint32_t state);
+void led_set_user(uint8_t usb_led);
@@ -0,0 +1,6 @@
+// ホストでのテスト用  tmk_core/common/raw_hid.hと同じ宣言  送ったパケットはtests/host_qmk.cが記録する
+#pragma once
+#include <stdint.h>
+
+void raw_hid_receive(uint8_t *data, uint8_t length);
+void raw_hid_send(uint8_t *data, uint8_t length);
@@ -0,0 +1,11 @@
+// ホストでのテスト用  テストが進める時刻(ms)
+#pragma once
+#include <stdint.h>
+
+#define TIMER_DIFF_16(a, b) ((uint16_t)((a) - (b)))
+
+extern uint32_t test_timer;
+static inline uint16_t timer_read(void) { return (uint16_t)test_timer; }
+static inline uint32_t timer_read32(void) { return test_timer; }
+static inline uint16_t timer_elapsed(uint16_t last) { return TIMER_DIFF_16(timer_read(), last); }
+static inline uint32_t timer_elapsed32(uint32_t last) { return test_timer - last; }